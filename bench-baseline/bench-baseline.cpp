@@ -0,0 +1,337 @@
+// Baseline store and regression check for the kernels' result records.
+//
+// The kernels write CSV records (BENCH_FORMAT=csv, see results.h). Every
+// record carries one or more "sample" metrics: a time for one repetition,
+// where lower is better. This tool keeps those records in a file-based store,
+//
+//   <store>/<machine fingerprint>/machine       what the fingerprint stands for
+//   <store>/<machine fingerprint>/index         recorded commits, oldest first
+//   <store>/<machine fingerprint>/<commit>.csv  the records for that commit
+//
+// and compares a fresh run against one of them:
+//
+//   bench-baseline record  <store> <commit> <results.csv>
+//   bench-baseline compare <store> <results.csv> [<baseline commit>]
+//
+// compare defaults to the most recently recorded commit. For each kernel,
+// variant, problem size and thread count present in both, the samples are
+// put through a one-sided Mann-Whitney U test; a kernel only fails when the
+// slowdown is statistically significant at BENCH_ALPHA (default 0.01), not
+// when it crosses some fixed percentage. The exit status is 1 if anything
+// regressed, 2 on usage or I/O errors. Samples from runs the runner marked
+// invalid (a noisy machine, see machine.hpp) are left out on both sides.
+//
+// The fingerprint is the CPU model and logical CPU count, so baselines can
+// be shared between identical machines; set BENCH_MACHINE to override it.
+
+#define _CRT_SECURE_NO_WARNINGS 1
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "result_reader.hpp"
+
+typedef std::map<std::string, std::vector<double> > sample_map;
+
+// key: "kernel-variant size (threads)" -> every sample of every record with
+// that key, leaving out records the runner marked invalid (valid == 0)
+bool read_samples(const std::string& path, sample_map& samples)
+{
+	std::vector<result_row> rows;
+	if(!read_result_rows(path, rows)) {
+		return false;
+	}
+	// a record's rows are contiguous and share everything but the metric;
+	// only "sample" (and other "sample_" series, which are not compared)
+	// appears more than once within one record, so two runs in the same
+	// second still come apart where a metric name repeats
+	for(size_t first = 0; first < rows.size(); ) {
+		size_t last = first;
+		bool valid = true;
+		std::set<std::string> metrics;
+		while(last < rows.size() && rows[last].timestamp == rows[first].timestamp && rows[last].kernel == rows[first].kernel
+		   && rows[last].variant == rows[first].variant && rows[last].size == rows[first].size && rows[last].threads == rows[first].threads
+		   && (rows[last].metric.compare(0, 6, "sample") == 0 || metrics.insert(rows[last].metric).second)) {
+			if(rows[last].metric == "valid" && rows[last].value == 0.0) {
+				valid = false;
+			}
+			++last;
+		}
+		std::ostringstream key;
+		key << rows[first].kernel << "-" << rows[first].variant << " " << rows[first].size << " (" << rows[first].threads << " threads)";
+		for(size_t i = first; i < last && valid; ++i) {
+			if(rows[i].metric == "sample") {
+				samples[key.str()].push_back(rows[i].value);
+			}
+		}
+		if(!valid) {
+			std::cerr << "bench-baseline: skipping an invalid run of " << key.str() << std::endl;
+		}
+		first = last;
+	}
+	return true;
+}
+
+std::string machine_description()
+{
+	if(const char* machine = std::getenv("BENCH_MACHINE")) {
+		return machine;
+	}
+	std::string model;
+	unsigned cpus = 0;
+#ifdef _WIN32
+	if(const char* id = std::getenv("PROCESSOR_IDENTIFIER")) {
+		model = id;
+	}
+	if(const char* n = std::getenv("NUMBER_OF_PROCESSORS")) {
+		cpus = static_cast<unsigned>(std::atoi(n));
+	}
+#else
+	std::ifstream cpuinfo("/proc/cpuinfo");
+	std::string line;
+	while(std::getline(cpuinfo, line)) {
+		if(line.compare(0, 10, "model name") == 0 && model.empty()) {
+			model = line.substr(line.find(':') + 2);
+		}
+		if(line.compare(0, 9, "processor") == 0) {
+			++cpus;
+		}
+	}
+	if(cpus == 0) {
+		cpus = static_cast<unsigned>(::sysconf(_SC_NPROCESSORS_ONLN));
+	}
+#endif
+	std::ostringstream os;
+	os << (model.empty() ? "unknown cpu" : model) << " x" << cpus;
+	return os.str();
+}
+
+std::string fingerprint(const std::string& description)
+{
+	unsigned long long hash = 14695981039346656037ull;
+	for(size_t i = 0; i < description.size(); ++i) {
+		hash = (hash ^ static_cast<unsigned char>(description[i])) * 1099511628211ull;
+	}
+	char buffer[17];
+	std::sprintf(buffer, "%016llx", hash);
+	return buffer;
+}
+
+void make_directory(const std::string& path)
+{
+#ifdef _WIN32
+	::_mkdir(path.c_str());
+#else
+	::mkdir(path.c_str(), 0777);
+#endif
+}
+
+double median(std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	const size_t n = values.size();
+	return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2.0;
+}
+
+// One-sided Mann-Whitney U test of "current tends to be larger (slower)
+// than baseline". Exact for small samples without ties, otherwise the
+// normal approximation with tie and continuity corrections.
+double mann_whitney_p(const std::vector<double>& baseline, const std::vector<double>& current)
+{
+	const size_t n1 = current.size(), n2 = baseline.size();
+	std::vector<std::pair<double, int> > all;
+	for(size_t i = 0; i < n1; ++i) {
+		all.push_back(std::make_pair(current[i], 1));
+	}
+	for(size_t i = 0; i < n2; ++i) {
+		all.push_back(std::make_pair(baseline[i], 2));
+	}
+	std::sort(all.begin(), all.end());
+
+	// mid-ranks, and the tie correction term sum(t^3 - t)
+	double rank_sum = 0.0, ties = 0.0;
+	for(size_t i = 0; i < all.size(); ) {
+		size_t j = i;
+		while(j < all.size() && all[j].first == all[i].first) {
+			++j;
+		}
+		const double rank = (i + 1 + j) / 2.0;
+		for(size_t k = i; k < j; ++k) {
+			if(all[k].second == 1) {
+				rank_sum += rank;
+			}
+		}
+		const double t = static_cast<double>(j - i);
+		ties += t * t * t - t;
+		i = j;
+	}
+	const double u = rank_sum - n1 * (n1 + 1) / 2.0;
+
+	if(ties == 0.0 && n1 <= 20 && n2 <= 20) {
+		// f[a][b][k]: orderings of a current and b baseline samples with U == k
+		std::vector<std::vector<std::vector<double> > > f(n1 + 1, std::vector<std::vector<double> >(n2 + 1));
+		for(size_t a = 0; a <= n1; ++a) {
+			for(size_t b = 0; b <= n2; ++b) {
+				f[a][b].assign(a * b + 1, 0.0);
+				if(a == 0 || b == 0) {
+					f[a][b][0] = 1.0;
+					continue;
+				}
+				// largest element is from current: it exceeds all b baseline samples
+				for(size_t k = 0; k < f[a - 1][b].size(); ++k) {
+					f[a][b][k + b] += f[a - 1][b][k];
+				}
+				// largest element is from baseline: contributes nothing
+				for(size_t k = 0; k < f[a][b - 1].size(); ++k) {
+					f[a][b][k] += f[a][b - 1][k];
+				}
+			}
+		}
+		const std::vector<double>& dist = f[n1][n2];
+		double total = 0.0, tail = 0.0;
+		for(size_t k = 0; k < dist.size(); ++k) {
+			total += dist[k];
+			if(static_cast<double>(k) >= u) {
+				tail += dist[k];
+			}
+		}
+		return tail / total;
+	}
+
+	const double n = static_cast<double>(n1 + n2);
+	const double mean = n1 * n2 / 2.0;
+	const double variance = n1 * n2 / 12.0 * ((n + 1) - ties / (n * (n - 1)));
+	if(variance <= 0.0) {
+		return 1.0;
+	}
+	const double z = (u - mean - 0.5) / std::sqrt(variance);
+	return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+int record(const std::string& store, const std::string& commit, const std::string& results)
+{
+	sample_map samples;
+	if(!read_samples(results, samples)) {
+		return 2;
+	}
+	const std::string description = machine_description();
+	const std::string directory = store + "/" + fingerprint(description);
+	make_directory(store);
+	make_directory(directory);
+	{
+		std::ofstream machine((directory + "/machine").c_str());
+		machine << description << "\n";
+	}
+	std::ifstream in(results.c_str(), std::ios_base::binary);
+	std::ofstream out((directory + "/" + commit + ".csv").c_str(), std::ios_base::binary | std::ios_base::trunc);
+	out << in.rdbuf();
+	if(!out) {
+		std::cerr << "bench-baseline: cannot write " << directory << "/" << commit << ".csv" << std::endl;
+		return 2;
+	}
+	std::ofstream index((directory + "/index").c_str(), std::ios_base::app);
+	index << commit << "\n";
+	std::cout << "recorded " << samples.size() << " kernels for " << commit << " on " << description << std::endl;
+	return 0;
+}
+
+int compare(const std::string& store, const std::string& results, std::string baseline_commit)
+{
+	const char* alpha_value = std::getenv("BENCH_ALPHA");
+	const double alpha = alpha_value ? std::atof(alpha_value) : 0.01;
+
+	const std::string description = machine_description();
+	const std::string directory = store + "/" + fingerprint(description);
+	if(baseline_commit.empty()) {
+		std::ifstream index((directory + "/index").c_str());
+		std::string line;
+		while(std::getline(index, line)) {
+			if(!line.empty()) {
+				baseline_commit = line;
+			}
+		}
+		if(baseline_commit.empty()) {
+			std::cerr << "bench-baseline: no baseline recorded for " << description << std::endl;
+			return 2;
+		}
+	}
+
+	sample_map baseline, current;
+	if(!read_samples(directory + "/" + baseline_commit + ".csv", baseline) || !read_samples(results, current)) {
+		return 2;
+	}
+
+	std::cout << "baseline " << baseline_commit << " on " << description << ", alpha " << alpha << "\n\n";
+	std::cout << std::left << std::setw(48) << "kernel" << std::right
+	          << std::setw(14) << "baseline" << std::setw(14) << "current"
+	          << std::setw(10) << "change" << std::setw(10) << "p" << "  result\n";
+
+	int regressions = 0;
+	for(sample_map::const_iterator it = current.begin(); it != current.end(); ++it) {
+		std::cout << std::left << std::setw(48) << it->first << std::right;
+		sample_map::const_iterator base = baseline.find(it->first);
+		if(base == baseline.end()) {
+			std::cout << std::setw(14) << "-" << std::setw(14) << median(it->second) << "\n";
+			continue;
+		}
+		const double before = median(base->second);
+		const double after = median(it->second);
+		const double slower = mann_whitney_p(base->second, it->second);
+		const double faster = mann_whitney_p(it->second, base->second);
+		// the smallest p the test can give is one over the number of
+		// orderings of the two samples; if that is not below alpha, a
+		// regression could never be detected
+		double orderings = 1.0;
+		for(size_t i = 1; i <= it->second.size(); ++i) {
+			orderings = orderings * (base->second.size() + i) / i;
+		}
+		const char* result = "ok";
+		if(1.0 / orderings >= alpha) {
+			result = "too few samples";
+		} else if(slower < alpha) {
+			result = "REGRESSION";
+			++regressions;
+		} else if(faster < alpha) {
+			result = "improved";
+		}
+		std::cout << std::setw(14) << before << std::setw(14) << after
+		          << std::fixed << std::setprecision(2) << std::setw(9) << (before > 0.0 ? 100.0 * (after - before) / before : 0.0) << "%"
+		          << std::setprecision(4) << std::setw(10) << std::min(slower, faster)
+		          << "  " << result << "\n";
+		std::cout.unsetf(std::ios_base::floatfield);
+		std::cout.precision(6);
+	}
+	std::cout << "\n" << (regressions ? "FAIL" : "PASS") << ": " << regressions << " regression(s)" << std::endl;
+	return regressions ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+	const std::string mode = argc > 1 ? argv[1] : "";
+	if(mode == "record" && argc == 5) {
+		return record(argv[2], argv[3], argv[4]);
+	}
+	if(mode == "compare" && (argc == 4 || argc == 5)) {
+		return compare(argv[2], argv[3], argc == 5 ? argv[4] : "");
+	}
+	std::cerr << "usage: bench-baseline record <store> <commit> <results.csv>\n"
+	          << "       bench-baseline compare <store> <results.csv> [<baseline commit>]" << std::endl;
+	return 2;
+}
@@ -0,0 +1,428 @@
+// Thread-count and problem-size sweeps.
+//
+//   bench-sweep [-t 1,2,4,...] [-b close|spread|master|false] [-p cores|threads|sockets]
+//               [-m 0,1,...|all [-r node]] [-o records.csv] [-c] <program> [<size>...]
+//
+// runs <program> once for every combination of problem size (its argv[1])
+// and thread count (OMP_NUM_THREADS). OMP_PROC_BIND and OMP_PLACES are set
+// as well, so that each thread stays on its own core (or wherever -b and -p
+// put it) rather than wandering. Without sizes the program runs with its
+// default. The thread counts default to powers of two up to the number of
+// logical CPUs, plus that number itself; either way they run fewest first.
+//
+// Each run writes its result records (results.h) to the -o file, which is
+// kept afterwards (default sweep.csv). A run's time is the median of its
+// "sample" metrics, so BENCH_REPETITIONS and friends apply as usual. For
+// every size the sweep prints
+//
+//   speedup     time with the fewest threads / time with this many
+//   efficiency  speedup per thread, relative to the fewest threads
+//   per unit    time per unit of work, where the kernel's work is known
+//               (tree nodes, pixels, permutations, ...), so that sizes can
+//               be compared with each other
+//
+// -m adds an axis over NUMA nodes for the program's buffers (buffers.h):
+// every run is repeated with BENCH_NUMA=bind and BENCH_NUMA_NODE set to each
+// node listed (all: every node with memory), while OMP_PLACES keeps the
+// threads on the CPUs of node -r (default 0). The thread counts then default
+// to those up to that node's CPU count. Each memory node gets its own table,
+// with
+//
+//   vs local    time with the memory on node -r / time with it here
+//
+// and the rates (MB/s metrics) the program reported, such as stream's, so
+// that local and remote memory can be told apart by bandwidth.
+//
+// -c prints the same as CSV, for plotting.
+
+#define _CRT_SECURE_NO_WARNINGS 1
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "result_reader.hpp"
+
+struct point {
+	std::string size;
+	int memory_node; // -1 unless bound
+	unsigned threads;
+	unsigned reported_threads;
+	double time; // microseconds
+	double units;
+	std::string unit;
+	std::vector<std::pair<std::string, double> > rates; // MB/s
+};
+
+void set_environment(const char* name, const std::string& value)
+{
+#ifdef _WIN32
+	::_putenv_s(name, value.c_str());
+#else
+	::setenv(name, value.c_str(), 1);
+#endif
+}
+
+// a list like 1,2,4 or, as Linux writes CPU and node lists, 0-3,8-11;
+// sorted, without duplicates, and only the numbers from minimum up
+std::vector<unsigned> parse_list(const std::string& list, int minimum)
+{
+	std::vector<unsigned> numbers;
+	std::istringstream in(list);
+	std::string item;
+	while(std::getline(in, item, ',')) {
+		const std::string::size_type dash = item.find('-');
+		const int first = std::atoi(item.c_str());
+		const int last = dash == std::string::npos ? first : std::atoi(item.c_str() + dash + 1);
+		for(int n = std::max(first, minimum); n <= last; ++n) {
+			numbers.push_back(static_cast<unsigned>(n));
+		}
+	}
+	std::sort(numbers.begin(), numbers.end());
+	numbers.erase(std::unique(numbers.begin(), numbers.end()), numbers.end());
+	return numbers;
+}
+
+// fewest first, which the speedups are relative to
+std::vector<unsigned> parse_threads(const std::string& list)
+{
+	return parse_list(list, 1);
+}
+
+// a Linux sysfs list under /sys/devices/system/node, empty if there is none
+std::vector<unsigned> read_node_list(const std::string& name)
+{
+	std::ifstream in(("/sys/devices/system/node/" + name).c_str());
+	std::string line;
+	if(!std::getline(in, line)) {
+		return std::vector<unsigned>();
+	}
+	return parse_list(line, 0);
+}
+
+std::vector<unsigned> default_threads(unsigned cpus)
+{
+	if(cpus == 0) {
+		cpus = 1;
+	}
+	std::vector<unsigned> threads;
+	for(unsigned n = 1; n < cpus; n *= 2) {
+		threads.push_back(n);
+	}
+	threads.push_back(cpus);
+	return threads;
+}
+
+// units of work done by one run of a kernel at a given size, where that is
+// known; otherwise one "run"
+double work(const std::string& kernel, const std::string& size, std::string& unit)
+{
+	const double n = std::atof(size.c_str());
+	if(kernel == "binary-trees") {
+		// the stretch and long lived trees, and 2 * 2^(max - d + min)
+		// trees of depth d for every other depth d from min up
+		const int min_depth = 4, max_depth = static_cast<int>(n);
+		double nodes = std::ldexp(1.0, max_depth + 2) - 1 + std::ldexp(1.0, max_depth + 1) - 1;
+		for(int d = min_depth; d <= max_depth; d += 2) {
+			nodes += 2 * std::ldexp(1.0, max_depth - d + min_depth) * (std::ldexp(1.0, d + 1) - 1);
+		}
+		unit = "node";
+		return nodes;
+	}
+	if(kernel == "fannkuch-redux") {
+		double permutations = 1;
+		for(int i = 2; i <= static_cast<int>(n); ++i) {
+			permutations *= i;
+		}
+		unit = "permutation";
+		return permutations;
+	}
+	if(kernel == "mandelbrot") {
+		unit = "pixel";
+		return n * n;
+	}
+	if(kernel == "spectral-norm") {
+		unit = "matrix element";
+		return n * n;
+	}
+	if(kernel == "n-body") {
+		unit = "step";
+		return n;
+	}
+	if(kernel == "fasta-redux" || kernel == "fasta-combo") {
+		// n ALU repeats, 3n IUB and 5n Homo sapiens nucleotides
+		unit = "nucleotide";
+		return 10 * n;
+	}
+	if(kernel == "stream") {
+		unit = "array element";
+		return n;
+	}
+	unit = "run";
+	return 1;
+}
+
+double median(std::vector<double> values)
+{
+	if(values.empty()) {
+		return 0.0;
+	}
+	std::sort(values.begin(), values.end());
+	const size_t n = values.size();
+	return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2.0;
+}
+
+bool run(const std::string& program, const std::string& size, int memory_node, unsigned threads, const std::string& records, size_t& seen, point& p)
+{
+	std::ostringstream count;
+	count << threads;
+	set_environment("OMP_NUM_THREADS", count.str());
+	if(memory_node >= 0) {
+		std::ostringstream node;
+		node << memory_node;
+		set_environment("BENCH_NUMA", "bind");
+		set_environment("BENCH_NUMA_NODE", node.str());
+	}
+
+#ifdef _WIN32
+	const std::string command = "\"" + program + "\" " + size + " > NUL";
+#else
+	const std::string command = "'" + program + "' " + size + " > /dev/null";
+#endif
+	if(std::system(command.c_str()) != 0) {
+		std::cerr << "bench-sweep: " << command << " failed" << std::endl;
+		return false;
+	}
+
+	std::vector<result_row> rows;
+	if(!read_result_rows(records, rows)) {
+		return false;
+	}
+	std::vector<double> samples;
+	p.size = size;
+	p.memory_node = memory_node;
+	p.threads = threads;
+	p.reported_threads = threads;
+	p.rates.clear();
+	for(size_t i = seen; i < rows.size(); ++i) {
+		if(rows[i].metric == "sample") {
+			samples.push_back(rows[i].value);
+		} else if(rows[i].unit == "MB/s") {
+			p.rates.push_back(std::make_pair(rows[i].metric, rows[i].value));
+		}
+		p.size = rows[i].size;
+		p.units = work(rows[i].kernel, rows[i].size, p.unit);
+		p.reported_threads = static_cast<unsigned>(rows[i].threads);
+	}
+	seen = rows.size();
+	if(samples.empty()) {
+		std::cerr << "bench-sweep: " << command << " wrote no samples" << std::endl;
+		return false;
+	}
+	p.time = median(samples);
+	return true;
+}
+
+// time on the run node for the same size and thread count, 0 if not swept
+double local_time(const std::vector<point>& points, const point& p, int run_node)
+{
+	for(size_t i = 0; i < points.size(); ++i) {
+		if(points[i].size == p.size && points[i].threads == p.threads && points[i].memory_node == run_node) {
+			return points[i].time;
+		}
+	}
+	return 0.0;
+}
+
+void print(const std::vector<point>& points, bool csv, bool nodes, int run_node)
+{
+	// the rates of the first point name the columns; a program reports the
+	// same ones every run
+	const std::vector<std::pair<std::string, double> > rates = points.empty() ? std::vector<std::pair<std::string, double> >() : points[0].rates;
+	if(csv) {
+		std::cout << "size," << (nodes ? "memory_node," : "") << "threads,time_us,speedup,efficiency,ns_per_unit,unit";
+		if(nodes) {
+			std::cout << ",vs_local";
+			for(size_t k = 0; k < rates.size(); ++k) {
+				std::cout << "," << rates[k].first;
+			}
+		}
+		std::cout << "\n";
+	}
+	for(size_t first = 0; first < points.size(); ) {
+		size_t last = first;
+		while(last < points.size() && points[last].size == points[first].size && points[last].memory_node == points[first].memory_node) {
+			++last;
+		}
+		const point& base = points[first];
+		if(!csv) {
+			std::cout << "\nsize " << base.size;
+			if(nodes) {
+				std::cout << ", memory on node " << base.memory_node << ", threads on node " << run_node;
+			}
+			std::cout << "\n"
+			          << std::setw(8) << "threads" << std::setw(14) << "median ms"
+			          << std::setw(10) << "speedup" << std::setw(12) << "efficiency";
+			if(nodes) {
+				std::cout << std::setw(10) << "vs local";
+				for(size_t k = 0; k < rates.size(); ++k) {
+					std::cout << std::setw(14) << rates[k].first;
+				}
+			}
+			std::cout << std::setw(14) << "ns per unit" << "\n";
+		}
+		for(size_t i = first; i < last; ++i) {
+			const point& p = points[i];
+			const double speedup = base.time / p.time;
+			const double efficiency = speedup * base.threads / p.threads;
+			const double per_unit = 1000.0 * p.time / p.units;
+			const double local = local_time(points, p, run_node);
+			if(csv) {
+				std::cout << p.size << ",";
+				if(nodes) {
+					std::cout << p.memory_node << ",";
+				}
+				std::cout << p.threads << "," << p.time << "," << speedup << ","
+				          << efficiency << "," << per_unit << "," << p.unit;
+				if(nodes) {
+					std::cout << ",";
+					if(local > 0.0) {
+						std::cout << local / p.time;
+					}
+					for(size_t k = 0; k < rates.size(); ++k) {
+						std::cout << "," << (k < p.rates.size() ? p.rates[k].second : 0.0);
+					}
+				}
+				std::cout << "\n";
+			} else {
+				std::cout << std::fixed << std::setw(8) << p.threads
+				          << std::setprecision(3) << std::setw(14) << p.time / 1000.0
+				          << std::setprecision(2) << std::setw(10) << speedup << std::setw(12) << efficiency;
+				if(nodes) {
+					if(local > 0.0) {
+						std::cout << std::setw(10) << local / p.time;
+					} else {
+						std::cout << std::setw(10) << "-";
+					}
+					std::cout << std::setprecision(1);
+					for(size_t k = 0; k < rates.size(); ++k) {
+						std::cout << std::setw(14) << (k < p.rates.size() ? p.rates[k].second : 0.0);
+					}
+				}
+				std::cout << std::setprecision(3) << std::setw(14) << per_unit << " /" << p.unit;
+				if(p.reported_threads != p.threads) {
+					std::cout << " (ran " << p.reported_threads << " threads)";
+				}
+				std::cout << "\n";
+				std::cout.unsetf(std::ios_base::floatfield);
+			}
+		}
+		first = last;
+	}
+	std::cout.flush();
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<unsigned> threads;
+	std::vector<int> memory_nodes; // -1 alone: not bound
+	std::string bind = "close", places = "cores", records = "sweep.csv";
+	bool csv = false, nodes = false;
+	int run_node = 0;
+	int arg = 1;
+	for(; arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; ++arg) {
+		const std::string option = argv[arg];
+		if(option == "-c") {
+			csv = true;
+		} else if(arg + 1 < argc && option == "-t") {
+			threads = parse_threads(argv[++arg]);
+		} else if(arg + 1 < argc && option == "-b") {
+			bind = argv[++arg];
+		} else if(arg + 1 < argc && option == "-p") {
+			places = argv[++arg];
+		} else if(arg + 1 < argc && option == "-o") {
+			records = argv[++arg];
+		} else if(arg + 1 < argc && option == "-m") {
+			const std::string list = argv[++arg];
+			const std::vector<unsigned> listed = list == "all" ? read_node_list("has_memory") : parse_list(list, 0);
+			memory_nodes.assign(listed.begin(), listed.end());
+			nodes = true;
+		} else if(arg + 1 < argc && option == "-r") {
+			run_node = std::atoi(argv[++arg]);
+		} else {
+			break;
+		}
+	}
+	const bool defaulted = threads.empty();
+	if(nodes) {
+		// the threads stay on the run node's CPUs, one place each
+		std::ostringstream list;
+		std::ostringstream cpulist;
+		cpulist << "node" << run_node << "/cpulist";
+		const std::vector<unsigned> cpus = read_node_list(cpulist.str());
+		if(cpus.empty()) {
+			std::cerr << "bench-sweep: no CPUs found for node " << run_node << std::endl;
+			return 1;
+		}
+		for(size_t i = 0; i < cpus.size(); ++i) {
+			list << (i ? "," : "") << "{" << cpus[i] << "}";
+		}
+		places = list.str();
+		if(defaulted) {
+			threads = default_threads(static_cast<unsigned>(cpus.size()));
+		}
+	} else {
+		memory_nodes.push_back(-1);
+		if(defaulted) {
+			threads = default_threads(std::thread::hardware_concurrency());
+		}
+	}
+	if(arg >= argc || threads.empty() || memory_nodes.empty()) {
+		std::cerr << "usage: bench-sweep [-t 1,2,4,...] [-b close|spread|master|false] [-p cores|threads|sockets]\n"
+		          << "                   [-m 0,1,...|all [-r node]] [-o records.csv] [-c] <program> [<size>...]" << std::endl;
+		return 2;
+	}
+	const std::string program = argv[arg++];
+	std::vector<std::string> sizes(argv + arg, argv + argc);
+	if(sizes.empty()) {
+		sizes.push_back("");
+	}
+
+	std::remove(records.c_str());
+	set_environment("BENCH_FORMAT", "csv");
+	set_environment("BENCH_RESULTS", records);
+	set_environment("OMP_PROC_BIND", bind);
+	set_environment("OMP_PLACES", places);
+
+	std::vector<point> points;
+	size_t seen = 0;
+	for(size_t s = 0; s < sizes.size(); ++s) {
+		for(size_t m = 0; m < memory_nodes.size(); ++m) {
+			const int memory_node = memory_nodes[m];
+			for(size_t t = 0; t < threads.size(); ++t) {
+				point p;
+				if(!run(program, sizes[s], memory_node, threads[t], records, seen, p)) {
+					return 1;
+				}
+				if(!csv) {
+					std::cerr << "size " << (p.size.empty() ? "default" : p.size);
+					if(nodes) {
+						std::cerr << ", memory on node " << memory_node;
+					}
+					std::cerr << ", " << p.threads << " threads: " << p.time / 1000.0 << " ms" << std::endl;
+				}
+				points.push_back(p);
+			}
+		}
+	}
+	print(points, csv, nodes, run_node);
+	return 0;
+}
@@ -14,90 +14,141 @@
 #include <cstdlib>
 #include <cstdio>
 
-#include <boost/pool/object_pool.hpp>
-
-#include "timer.hpp"
+#include "binary_trees.hpp"
+#include "regions.hpp"
 
 const size_t	LINE_SIZE = 64;
 
-struct Node
+template<typename Store>
+void binary_trees(int min_depth, int max_depth, bool print)
 {
-	Node *l, *r;
-	int i;
+	int stretch_depth = max_depth+1;
 
-	Node(int i2) : l(0), r(0), i(i2) 
-	{}
-	Node(Node *l2, int i2, Node *r2) : l(l2), r(r2), i(i2) 
-	{}
+	// Alloc then dealloc stretchdepth tree
+	{
+		scoped_region region("stretch tree");
+		Store::reserve(tree_nodes(stretch_depth));
+		Store store;
+		Node *c = make(0, stretch_depth, store);
+		int check = check_tree(c);
+		if (print)
+			std::cout << "stretch tree of depth " << stretch_depth << "\t "
+				<< "check: " << check << std::endl;
+		release(c, store);
+	}
 
-	int check() const 
+	Store long_lived_store;
+	Node *long_lived_tree = 0;
 	{
-		if (l)
-			return l->check() + i - r->check();
-		else return i;
+		scoped_region region("long lived tree");
+		Store::reserve(tree_nodes(max_depth));
+		long_lived_tree = make(0, max_depth, long_lived_store);
 	}
-};
 
-typedef boost::object_pool<Node> NodePool;
+	// buffer to store output of each thread
+	char *outputstr = (char*)malloc(LINE_SIZE * (max_depth +1) * sizeof(char));
 
-Node *make(int i, int d, NodePool &store) 
-{
-	if (d > 0) 
-		return store.construct(	make(2*i-1, d-1, store), 
-		i, 
-		make(2*i, d-1, store)	);
-	return store.construct(i);
+	for (int d = min_depth; d <= max_depth; d += 2) 
+	{
+		scoped_region region("depth");
+		int iterations = 1 << (max_depth - d + min_depth);
+		int c = 0;
+
+		// room for both trees of an iteration, so that with a thread-arena
+		// each iteration only rewinds its thread's region
+		Store::reserve(2 * tree_nodes(d));
+		for (int i = 1; i <= iterations; ++i) 
+		{
+			Store store;
+			Node *a = make(i, d, store), *b = make(-i, d, store);
+			const Node *pair[] = { a, b };
+			c += check_trees(pair, 2);
+			release(a, store);
+			release(b, store);
+		}
+
+		// each thread write to separate location
+		sprintf(outputstr + LINE_SIZE * d, "%d\t trees of depth %d\t check: %d\n", (2 * iterations), d, c);
+	}
+
+	// print all results
+	for (int d = min_depth; d <= max_depth && print; d += 2) 
+		printf("%s", outputstr + (d * LINE_SIZE) );
+	free(outputstr);
+
+	int check = check_tree(long_lived_tree);
+	if (print)
+		std::cout << "long lived tree of depth " << max_depth << "\t "
+			<< "check: " << check << "\n";
+	release(long_lived_tree, long_lived_store);
 }
 
-int main(int argc, char *argv[]) 
+template<typename Tree>
+void array_binary_trees(int min_depth, int max_depth, bool print)
 {
-	high_resolution_timer timer;
-
-	int min_depth = 4;
-	int max_depth = std::max(min_depth+2,
-		(argc == 2 ? atoi(argv[1]) : 20));
 	int stretch_depth = max_depth+1;
 
-	// Alloc then dealloc stretchdepth tree
 	{
-		NodePool store;
-		Node *c = make(0, stretch_depth, store);
-		std::cout << "stretch tree of depth " << stretch_depth << "\t "
-			<< "check: " << c->check() << std::endl;
+		scoped_region region("stretch tree");
+		Tree c;
+		c.build(0, stretch_depth);
+		int check = c.check();
+		if (print)
+			std::cout << "stretch tree of depth " << stretch_depth << "\t "
+				<< "check: " << check << std::endl;
 	}
 
-	NodePool long_lived_store;
-	Node *long_lived_tree = make(0, max_depth, long_lived_store);
+	Tree long_lived_tree;
+	{
+		scoped_region region("long lived tree");
+		long_lived_tree.build(0, max_depth);
+	}
 
-	// buffer to store output of each thread
 	char *outputstr = (char*)malloc(LINE_SIZE * (max_depth +1) * sizeof(char));
 
 	for (int d = min_depth; d <= max_depth; d += 2) 
 	{
+		scoped_region region("depth");
 		int iterations = 1 << (max_depth - d + min_depth);
 		int c = 0;
 
+		// one pair of arrays for all the iterations
+		Tree a, b;
 		for (int i = 1; i <= iterations; ++i) 
 		{
-			NodePool store;
-			Node *a = make(i, d, store), *b = make(-i, d, store);
-			c += a->check() + b->check();
+			a.build(i, d);
+			b.build(-i, d);
+			c += a.check() + b.check();
 		}
 
-		// each thread write to separate location
 		sprintf(outputstr + LINE_SIZE * d, "%d\t trees of depth %d\t check: %d\n", (2 * iterations), d, c);
 	}
 
-	// print all results
-	for (int d = min_depth; d <= max_depth; d += 2) 
+	for (int d = min_depth; d <= max_depth && print; d += 2) 
 		printf("%s", outputstr + (d * LINE_SIZE) );
 	free(outputstr);
 
-	std::cout << "long lived tree of depth " << max_depth << "\t "
-		<< "check: " << (long_lived_tree->check()) << "\n";
+	int check = long_lived_tree.check();
+	if (print)
+		std::cout << "long lived tree of depth " << max_depth << "\t "
+			<< "check: " << check << "\n";
+}
+
+// the kernel, as binary_trees_main() runs it (see binary_trees.hpp)
+struct kernel
+{
+	template<typename Store> static void pointer_trees(int min_depth, int max_depth, bool print)
+	{
+		binary_trees<Store>(min_depth, max_depth, print);
+	}
 
-	high_resolution_timer::duration dur = timer.pulse();
+	template<typename Tree> static void array_trees(int min_depth, int max_depth, bool print)
+	{
+		array_binary_trees<Tree>(min_depth, max_depth, print);
+	}
+};
 
-	std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(dur).count() << std::endl;
-	return 0;
+int main(int argc, char *argv[]) 
+{
+	return binary_trees_main<kernel>(argc, argv);
 }
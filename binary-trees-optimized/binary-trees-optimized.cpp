@@ -10,95 +10,350 @@
 #define _CRT_SECURE_NO_WARNINGS 1
 #define BOOST_DISABLE_THREADS 1
 
+#include <algorithm>
 #include <iostream>
 #include <cstdlib>
 #include <cstdio>
+#include <string>
+#include <vector>
 #include <omp.h>
 
-#include <boost/pool/object_pool.hpp>
+#include "binary_trees.hpp"
+#include "regions.hpp"
 
-#include "timer.hpp"
+// The sweep over depths, cut into chunks of iterations so that there is
+// work for many more threads than there are depths; deepest first, since
+// their chunks take longest.
+struct sweep_chunk
+{
+	int d, first, last;
+};
 
-const size_t	LINE_SIZE = 64;
+std::vector<sweep_chunk> sweep_chunks(int min_depth, int max_depth)
+{
+	const int pieces = 8 * omp_get_max_threads();
+	std::vector<sweep_chunk> chunks;
+	for (int d = max_depth - (max_depth - min_depth) % 2; d >= min_depth; d -= 2)
+	{
+		int iterations = 1 << (max_depth - d + min_depth);
+		int size = std::max(1, iterations / pieces);
+		for (int first = 1; first <= iterations; first += size)
+		{
+			sweep_chunk chunk = { d, first, std::min(iterations, first + size - 1) };
+			chunks.push_back(chunk);
+		}
+	}
+	return chunks;
+}
 
-struct Node 
+// adds up the checks of each depth's chunks and prints the depths in order
+void print_sweep(const std::vector<sweep_chunk> &chunks, const std::vector<int> &checks, int min_depth, int max_depth)
 {
-	Node *l, *r;
-	int i;
+	for (int d = min_depth; d <= max_depth; d += 2) 
+	{
+		int iterations = 1 << (max_depth - d + min_depth);
+		int c = 0;
+		for (size_t k = 0; k < chunks.size(); ++k)
+			if (chunks[k].d == d)
+				c += checks[k];
+		printf("%d\t trees of depth %d\t check: %d\n", (2 * iterations), d, c);
+	}
+}
 
-	Node(int i2) : l(0), r(0), i(i2) 
-	{}
-	Node(Node *l2, int i2, Node *r2) : l(l2), r(r2), i(i2) 
+// The stretch and long-lived trees are built and checked by tasks, which
+// the threads of the team steal from each other: the levels above a cutoff
+// depth are forked, and each subtree at the cutoff is built or checked by
+// one task. BENCH_TASK_CUTOFF sets the depth; by default there are about 8
+// subtrees per thread, and none with one thread. Tasks came with OpenMP
+// 3.0; without them the trees are built and checked in one go as before.
+#if defined(_OPENMP) && _OPENMP >= 200805
+#define TREE_TASKS 1
+#endif
+
+int task_cutoff(int max_depth)
+{
+	const char *cutoff = std::getenv("BENCH_TASK_CUTOFF");
+	if (cutoff && *cutoff)
+		return atoi(cutoff);
+	int threads = omp_get_max_threads(), levels = 0;
+	if (threads > 1)
+		for (levels = 3; (1 << (levels - 3)) < threads; ++levels)
+			;
+	return std::max(0, max_depth - levels);
+}
+
+// One store per thread of a team, made by that thread, so that each task
+// builds from the store of the thread running it. The stores go when this
+// does, after the team is done with them.
+template<typename Store>
+class worker_stores
+{
+public:
+	worker_stores() : stores(omp_get_max_threads())
 	{}
 
-	int check() const 
+	~worker_stores()
+	{
+		for (size_t t = 0; t < stores.size(); ++t)
+			delete stores[t];
+	}
+
+	// called by every thread of the team
+	void open()
 	{
-		if (l)
-			return l->check() + i - r->check();
-		else return i;
+		stores[omp_get_thread_num()] = new Store;
 	}
+
+	Store &local()
+	{
+		return *stores[omp_get_thread_num()];
+	}
+
+private:
+	std::vector<Store*> stores;
+
+	worker_stores(const worker_stores&);
+	worker_stores& operator=(const worker_stores&);
 };
 
-typedef boost::object_pool<Node> NodePool;
+template<typename Store>
+Node *make_tasks(int i, int d, worker_stores<Store> &stores, int cutoff)
+{
+	if (d <= cutoff)
+		return make(i, d, stores.local());
+	Node *l, *r;
+#ifdef TREE_TASKS
+#pragma omp task shared(l, stores) firstprivate(i, d, cutoff)
+#endif
+	l = make_tasks(2*i-1, d-1, stores, cutoff);
+	r = make_tasks(2*i, d-1, stores, cutoff);
+#ifdef TREE_TASKS
+#pragma omp taskwait
+#endif
+	return stores.local().construct(l, i, r);
+}
 
-Node *make(int i, int d, NodePool &store) 
+// check() as a reduction over the subtrees at the cutoff
+int check_tasks(const Node *n, int d, int cutoff)
 {
-	if (d > 0) 
-		return store.construct(	make(2*i-1, d-1, store), 
-		i, 
-		make(2*i, d-1, store)	);
-	return store.construct(i);
+	if (d <= cutoff)
+		return check_tree(n);
+	int l, r;
+#ifdef TREE_TASKS
+#pragma omp task shared(l) firstprivate(n, d, cutoff)
+#endif
+	l = check_tasks(n->l, d-1, cutoff);
+	r = check_tasks(n->r, d-1, cutoff);
+#ifdef TREE_TASKS
+#pragma omp taskwait
+#endif
+	return l + n->i - r;
 }
 
-int main(int argc, char *argv[]) 
+// BENCH_REPLICATE: a long-lived tree for each NUMA node the team runs on,
+// built by the first thread found on that node (from a numa-arena, say, to
+// have it there) and checked at the end by the same thread, for threads
+// kept on their nodes with OMP_PROC_BIND. Every replica is the same tree;
+// the first is the one reported.
+bool replicate_long_lived()
 {
-	high_resolution_timer timer;
+	const char *replicate = std::getenv("BENCH_REPLICATE");
+	return replicate && *replicate && std::string(replicate) != "0";
+}
 
-	int min_depth = 4;
-	int max_depth = std::max(min_depth+2, (argc == 2 ? atoi(argv[1]) : 20));
+template<typename Store>
+void binary_trees(int min_depth, int max_depth, bool print)
+{
 	int stretch_depth = max_depth+1;
+	const int cutoff = task_cutoff(max_depth);
+	const bool replicate = replicate_long_lived();
+
+	const std::vector<sweep_chunk> chunks = sweep_chunks(min_depth, max_depth);
+	std::vector<int> checks(chunks.size());
+
+	// the nodes of a tree go back to whichever thread's store releases them,
+	// and all the stores go together at the end, so that none gives memory
+	// back that another still hands out
+	worker_stores<Store> stretch_stores, long_lived_stores;
+	Node *long_lived_tree = 0;
+	std::vector<Node*> replicas(BENCH_NUMA_MAX_NODES, 0);
+	std::vector<int> replica_builders(BENCH_NUMA_MAX_NODES, -1);
+
+	// one thread builds the stretch tree and the master the long-lived one
+	// while the others start on the sweep; the tasks of both trees go to
+	// whichever threads are free, the sweepers when they are done
+#pragma omp parallel default(shared)
+	{
+		stretch_stores.open();
+		long_lived_stores.open();
+#pragma omp barrier
 
-	// Alloc then dealloc stretchdepth tree
+#pragma omp single nowait
+		{
+			// Alloc then dealloc stretchdepth tree
+			scoped_region region("stretch tree");
+			Store::reserve(tree_nodes(std::min(stretch_depth, cutoff)));
+			Node *c = make_tasks(0, stretch_depth, stretch_stores, cutoff);
+			int check = check_tasks(c, stretch_depth, cutoff);
+			if (print)
+				std::cout << "stretch tree of depth " << stretch_depth << "\t "
+					<< "check: " << check << std::endl;
+			release(c, stretch_stores.local());
+		}
+
+#pragma omp master
+		if (!replicate)
+		{
+			scoped_region region("long lived tree");
+			Store::reserve(tree_nodes(std::min(max_depth, cutoff)));
+			long_lived_tree = make_tasks(0, max_depth, long_lived_stores, cutoff);
+		}
+
+		if (replicate)
+		{
+			int node = bench_numa_current_node();
+			if (node < 0 || node >= BENCH_NUMA_MAX_NODES)
+				node = 0;
+			bool first = false;
+#pragma omp critical(replicas)
+			if (replica_builders[node] < 0)
+			{
+				replica_builders[node] = omp_get_thread_num();
+				first = true;
+			}
+			if (first)
+			{
+				scoped_region region("long lived tree");
+				Store::reserve(tree_nodes(max_depth));
+				replicas[node] = make(0, max_depth, long_lived_stores.local());
+			}
+		}
+
+#pragma omp for schedule(dynamic, 1) nowait
+		for (int k = 0; k < static_cast<int>(chunks.size()); ++k) 
+		{
+			scoped_region region("depth");
+			const int d = chunks[k].d;
+			int c = 0;
+
+			// room for both trees of an iteration, so that with a thread-arena
+			// each iteration only rewinds its thread's region
+			Store::reserve(2 * tree_nodes(d));
+			for (int i = chunks[k].first; i <= chunks[k].last; ++i) 
+			{
+				Store store;
+				Node *a = make(i, d, store), *b = make(-i, d, store);
+				const Node *pair[] = { a, b };
+				c += check_trees(pair, 2);
+				release(a, store);
+				release(b, store);
+			}
+			checks[k] = c;
+		}
+	}
+
+	if (print)
+		print_sweep(chunks, checks, min_depth, max_depth);
+
+	int check = 0;
+	if (replicate)
 	{
-		NodePool store;
-		Node *c = make(0, stretch_depth, store);
-		std::cout << "stretch tree of depth " << stretch_depth << "\t "
-			<< "check: " << c->check() << std::endl;
+		std::vector<int> replica_checks(BENCH_NUMA_MAX_NODES, 0);
+#pragma omp parallel default(shared)
+		for (int node = 0; node < BENCH_NUMA_MAX_NODES; ++node)
+			if (replica_builders[node] == omp_get_thread_num())
+				replica_checks[node] = check_tree(replicas[node]);
+		for (int node = BENCH_NUMA_MAX_NODES - 1; node >= 0; --node)
+		{
+			if (replicas[node])
+			{
+				check = replica_checks[node];
+				release(replicas[node], long_lived_stores.local());
+			}
+		}
 	}
+	else
+	{
+#pragma omp parallel default(shared)
+#pragma omp single
+		check = check_tasks(long_lived_tree, max_depth, cutoff);
+		release(long_lived_tree, long_lived_stores.local());
+	}
+	if (print)
+		std::cout << "long lived tree of depth " << max_depth << "\t "
+			<< "check: " << check << "\n";
+}
 
-	NodePool long_lived_store;
-	Node *long_lived_tree = make(0, max_depth, long_lived_store);
+template<typename Tree>
+void array_binary_trees(int min_depth, int max_depth, bool print)
+{
+	int stretch_depth = max_depth+1;
 
-	// buffer to store output of each thread
-	char *outputstr = (char*)malloc(LINE_SIZE * (max_depth +1) * sizeof(char));
+	const std::vector<sweep_chunk> chunks = sweep_chunks(min_depth, max_depth);
+	std::vector<int> checks(chunks.size());
+	Tree long_lived_tree;
 
-#pragma omp parallel for default(shared) schedule(dynamic, 1)
-	for (int d = min_depth; d <= max_depth; d += 2) 
+#pragma omp parallel default(shared)
 	{
-		int iterations = 1 << (max_depth - d + min_depth);
-		int c = 0;
+#pragma omp single nowait
+		{
+			scoped_region region("stretch tree");
+			Tree c;
+			c.build(0, stretch_depth);
+			int check = c.check();
+			if (print)
+				std::cout << "stretch tree of depth " << stretch_depth << "\t "
+					<< "check: " << check << std::endl;
+		}
 
-		for (int i = 1; i <= iterations; ++i) 
+#pragma omp master
 		{
-			NodePool store;
-			Node *a = make(i, d, store), *b = make(-i, d, store);
-			c += a->check() + b->check();
+			scoped_region region("long lived tree");
+			long_lived_tree.build(0, max_depth);
 		}
 
-		// each thread write to separate location
-		sprintf(outputstr + LINE_SIZE * d, "%d\t trees of depth %d\t check: %d\n", (2 * iterations), d, c);
+		// one pair of arrays for all the iterations of a thread
+		Tree a, b;
+#pragma omp for schedule(dynamic, 1) nowait
+		for (int k = 0; k < static_cast<int>(chunks.size()); ++k) 
+		{
+			scoped_region region("depth");
+			const int d = chunks[k].d;
+			int c = 0;
+			for (int i = chunks[k].first; i <= chunks[k].last; ++i) 
+			{
+				a.build(i, d);
+				b.build(-i, d);
+				c += a.check() + b.check();
+			}
+			checks[k] = c;
+		}
 	}
 
-	// print all results
-	for (int d = min_depth; d <= max_depth; d += 2) 
-		printf("%s", outputstr + (d * LINE_SIZE) );
-	free(outputstr);
+	if (print)
+		print_sweep(chunks, checks, min_depth, max_depth);
 
-	std::cout << "long lived tree of depth " << max_depth << "\t "
-		<< "check: " << (long_lived_tree->check()) << "\n";
+	int check = long_lived_tree.check();
+	if (print)
+		std::cout << "long lived tree of depth " << max_depth << "\t "
+			<< "check: " << check << "\n";
+}
+
+// the kernel, as binary_trees_main() runs it (see binary_trees.hpp)
+struct kernel
+{
+	template<typename Store> static void pointer_trees(int min_depth, int max_depth, bool print)
+	{
+		binary_trees<Store>(min_depth, max_depth, print);
+	}
 
-	high_resolution_timer::duration dur = timer.pulse();
+	template<typename Tree> static void array_trees(int min_depth, int max_depth, bool print)
+	{
+		array_binary_trees<Tree>(min_depth, max_depth, print);
+	}
+};
 
-	std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(dur).count() << std::endl;
-	return 0;
+int main(int argc, char *argv[]) 
+{
+	return binary_trees_main<kernel>(argc, argv);
 }
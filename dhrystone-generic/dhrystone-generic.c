@@ -68,6 +68,8 @@ booleans Func3(Enumeration EnumParIn);
 #include <string.h>
 #include <time.h> 
 
+#include "results.h"
+
 /* this is truly rank, but it's minimally invasive, and lifted in part from the STREAM scores */
 
 static double secs;
@@ -149,6 +151,8 @@ void Proc0()
 
 	int         endit;
 	unsigned long count = 10;
+	int         correct;
+	bench_result result;
 
 	/* Initializations */
 
@@ -235,7 +239,8 @@ void Proc0()
 	printf ("\n");
 
 	printf ("Array2Glob8/7: ");
-	if (Array2Glob[8][7] == count + 10)
+	correct = Array2Glob[8][7] == count + 10;
+	if (correct)
 		printf ("O.K.  ");
 	else                   printf ("WRONG ");
 	printf ("%12.0f\n", (double) Array2Glob[8][7]);
@@ -252,6 +257,20 @@ void Proc0()
 	printf ("VAX  MIPS rating =                          ");
 	printf ("%12.2lf \n",Vax_Mips);
 	printf ("\n");
+
+	/* the loop count is calibrated, so it is a result, not a problem size */
+	bench_result_init(&result, "dhrystone", "generic", "calibrated");
+	bench_result_peak_rss(&result);
+	bench_result_metric(&result, "loops", (double) Loops, "");
+	bench_result_metric(&result, "time_per_run", Microseconds, "us");
+	bench_result_metric(&result, "dhrystones_per_second", Dhrystones_Per_Second, "1/s");
+	bench_result_metric(&result, "dmips", Vax_Mips, "DMIPS");
+	bench_result_metric(&result, "time", benchtime, "s");
+	/* a single timed run; repeat the program for more samples */
+	bench_result_metric(&result, "sample", Microseconds, "us");
+	bench_result_check(&result, correct ? "O.K." : "WRONG");
+	bench_result_emit(&result);
+	bench_result_free(&result);
 }
 
 void Proc1(RecordPtr PtrParIn)
@@ -6,8 +6,9 @@ contributed by Branimir Maksimovic
 #include <cstdio>
 #include <algorithm>
 #include <iostream>
+#include <vector>
 
-#include "timer.hpp"
+#include "runner.hpp"
 
 typedef unsigned char int_t;
 
@@ -38,15 +39,44 @@ struct Result{
 	int maxflips;
 };
 
-Result fannkuch(int n)
+long long factorial(int n)
+{
+	long long f = 1;
+	for(int i = 2; i <= n; ++i)f *= i;
+	return f;
+}
+
+// Permutation number index, in the order next_permutation() goes through
+// them, and the counts it would have got there with: index in the
+// factorial number system has c[i] as its digit of weight i!, and the
+// permutation is the identity with the first i+1 elements rotated c[i]
+// times, from the highest i down.
+void unrank(long long index, int n, int_t* perm, int_t* c)
+{
+	int_t before[16];
+	for(int i = 0; i < n; ++i)perm[i] = i+1;
+	for(int i = n-1; i > 0; --i)
+	{
+		const long long f = factorial(i);
+		const int d = (int)(index/f);
+		index %= f;
+		c[i] = d;
+		std::copy(perm,perm+i+1,before);
+		for(int j = 0; j <= i; ++j)perm[j] = before[(j+d)%(i+1)];
+	}
+	c[0] = 0;
+}
+
+// the permutations numbered first to first+count-1; each counts with the
+// sign of its own number's parity
+Result fannkuch_range(int n, long long first, long long count)
 {
-	Result tmp = {0};
-	int i=0,permcount=0;
+	Result tmp = {0, 0};
 	int_t perm[16],tperm[16],cnt[16]={0};
 
-	std::generate(perm,perm+n,[&i](){ return ++i; });
+	unrank(first,n,perm,cnt);
 
-	do
+	for(long long permcount = first; permcount < first+count; ++permcount)
 	{
 		std::copy(perm,perm+n,tperm);
 		int flips = 0;
@@ -57,25 +87,47 @@ Result fannkuch(int n)
 		}
 		tmp.checksum += (permcount%2 == 0)?flips:-flips;
 		tmp.maxflips = std::max(tmp.maxflips,flips);
-	}while(++permcount,next_permutation(perm,n,cnt));
+		next_permutation(perm,n,cnt);
+	}
 
 	return tmp;
 }
 
-int main(int argc, char** argv)
+// The n! permutations in up to 7! ranges of consecutive numbers, shared out
+// among the threads; the ranges' results are added up in order.
+Result fannkuch(int n)
 {
-	high_resolution_timer timer;
+	const long long total = factorial(n);
+	const int ranges = (int)std::min(total, factorial(7));
+	const long long size = (total+ranges-1)/ranges;
+	std::vector<Result> results(ranges);
 
+#pragma omp parallel for schedule(dynamic, 1)
+	for(int k = 0; k < ranges; ++k)
+	{
+		const long long first = k*size;
+		results[k] = fannkuch_range(n,first,std::min(size,total-first));
+	}
+
+	Result tmp = {0, 0};
+	for(int k = 0; k < ranges; ++k)
+	{
+		tmp.checksum += results[k].checksum;
+		tmp.maxflips = std::max(tmp.maxflips,results[k].maxflips);
+	}
+	return tmp;
+}
+
+int main(int argc, char** argv)
+{
 	int n = (argc > 1) ? atoi(argv[1]) : 12;
 	if(n < 3 || n > 16)
 	{
 		printf("n should be between [3 and 16]\n");
 		return 0;
 	}
-	Result r = fannkuch(n);
-	printf("%d\nPfannkuchen(%d) = %d\n",r.checksum,n,r.maxflips);
-
-	high_resolution_timer::duration dur = timer.pulse();
-
-	std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(dur).count() << std::endl;
+	return run_benchmark([=]() {
+		Result r = fannkuch(n);
+		printf("%d\nPfannkuchen(%d) = %d\n",r.checksum,n,r.maxflips);
+	}, benchmark_options::from_environment().identify(argv[0], n));
 }
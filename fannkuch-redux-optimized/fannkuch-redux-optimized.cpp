@@ -12,10 +12,11 @@
 #include <cstring>
 #include <algorithm>
 #include <iostream>
-#include <xmmintrin.h>
-#include <tmmintrin.h>
+#include <vector>
+#include <immintrin.h>
 
-#include "timer.hpp"
+#include "runner.hpp"
+#include "cpu_features.hpp"
 
 #ifdef WIN32
 #define ALIGN_SUFFIX(X)
@@ -25,16 +26,23 @@
 #define ALIGN_PREFIX(X)
 #endif
 
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 /* this depends highly on the platform.  It might be faster to use
 char type on 32-bit systems; it might be faster to use unsigned. */
 
 typedef char elem;
 
-ALIGN_PREFIX(16) elem s[16] ALIGN_SUFFIX(16);
+// each thread works through its own ranges of permutations (see main())
+ALIGN_PREFIX(16) THREAD_LOCAL elem s[16] ALIGN_SUFFIX(16);
 
-int maxflips = 0;
-int odd = 0;
-int checksum = 0;
+THREAD_LOCAL int maxflips = 0;
+THREAD_LOCAL int odd = 0;
+THREAD_LOCAL int checksum = 0;
 // naieve method of rotation using basic sisd instructions for sanity's sake
 inline void rotate_sisd(int n) {
 	elem c;
@@ -64,58 +72,56 @@ void popmasks() {
 	char truth[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
 	MM_ITRUE = _mm_loadu_si128((__m128i*)truth);
 }
-inline void rotate(int n) {
-	// use SSE to rotate the values
-	// n could get as high as the max for the range,
-	//   but only 16 constants will ever be needed
-	_mm_store_si128((__m128i*)s,
-		_mm_shuffle_epi8(_mm_load_si128((__m128i*)s),rotate_masks[n]));
-}
+// a permutation waiting to have its flips counted
+struct Perm {
+	__m128i perm;
+	elem start;
+	short odd;
+};
 
-void tk(int n) {
-	// for flipping
-	ALIGN_PREFIX(16) char tmp[16] ALIGN_SUFFIX(16);
-	ALIGN_PREFIX(16) char tmp2[16] ALIGN_SUFFIX(16);
-	// a place to put the backlog of permutations
-	struct Perm {
-		__m128i perm;
-		elem start;
-		short odd;
-	} perms[60];
+// What differs between instruction sets: how the generator rotates, and
+// how a batch of queued permutations has its flips counted. tk() is
+// compiled once per level with the level's pair of these inlined into it.
 
-	int i = 0;
-	elem c[16] = {0};
-	int perm_max = 0;
-	while (i < n) {
-		/* Tompkin-Paige iterative perm generation */
-		// fill the queue up to 60
-		while (i<n && perm_max<60) {
-			rotate(i);
-			if (c[i] >= i) {
-				c[i++] = 0;
-				continue;
-			}
+// naieve method for processors without SSSE3
+struct scalar_isa {
+	static void rotate(int n) {
+		rotate_sisd(n);
+	}
 
-			c[i]++;
-			i = 1;
-			odd = ~odd;
-			if (*s) {
-				if (s[(int)s[0]]) {
-					perms[perm_max].perm = _mm_load_si128((__m128i*)s);
-					perms[perm_max].start = *s;
-					perms[perm_max].odd = odd;
-					perm_max++;
-				} else {
-					if (maxflips==0) maxflips = 1;
-					checksum += odd ? -1 : 1;
-				}
+	static void count_flips(const Perm* perms, int count) {
+		for (int k = 0; k < count; ++k) {
+			elem p[16];
+			std::memcpy(p, &perms[k].perm, sizeof(p));
+			int f = 0, toterm = perms[k].start;
+			while (toterm) {
+				std::reverse(p, p + toterm + 1);
+				toterm = p[0];
+				++f;
 			}
+			if (f > maxflips) maxflips = f;
+			checksum += perms[k].odd ? -f : f;
 		}
-		// process the queue
+	}
+};
+
+struct sse_isa {
+	ISA_TARGET_SSE static void rotate(int n) {
+		// use SSE to rotate the values
+		// n could get as high as the max for the range,
+		//   but only 16 constants will ever be needed
+		_mm_store_si128((__m128i*)s,
+			_mm_shuffle_epi8(_mm_load_si128((__m128i*)s),rotate_masks[n]));
+	}
+
+	ISA_TARGET_SSE static void count_flips(const Perm* perms, int count) {
+		// for flipping
+		ALIGN_PREFIX(16) char tmp[16] ALIGN_SUFFIX(16);
+		ALIGN_PREFIX(16) char tmp2[16] ALIGN_SUFFIX(16);
 		int k;
 		// do 2 at a time when possible to take advantage of pipelining
 		// see the next loop for implementation logic
-		for (k=0; k<perm_max-1; k+=2) {
+		for (k=0; k<count-1; k+=2) {
 			__m128i perm1 = perms[k].perm;
 			__m128i perm2 = perms[k+1].perm;
 
@@ -150,7 +156,7 @@ void tk(int n) {
 			checksum += perms[k+1].odd ? -f2 : f2;
 		}
 		// finish up one at a time
-		for (;k<perm_max;++k) {
+		for (;k<count;++k) {
 			// get the data out of the structure
 			// the whole array is packed into an sse integer type
 			// we could use more fairly easily if we wanted to
@@ -168,27 +174,229 @@ void tk(int n) {
 			if (f > maxflips) maxflips = f;
 			checksum += perms[k].odd ? -f : f;
 		}
+	}
+};
+
+// The wider versions flip several permutations at once, one per 128-bit
+// lane; pshufb never crosses lanes, so each lane is its own permutation.
+// Rather than look up a flip mask by each lane's first element, they
+// compute it: broadcast the first element t across its lane, then element
+// j of the mask is t - j for j <= t and j beyond. A lane whose permutation
+// is done (t == 0) gets the identity and keeps still until the others are
+// done too. Flip counts are kept in bytes, which is plenty for n <= 16.
+inline void record_flips(const Perm& perm, int f) {
+	if (f > maxflips) maxflips = f;
+	checksum += perm.odd ? -f : f;
+}
+
+struct avx2_isa {
+	ISA_TARGET_AVX2 static void rotate(int n) {
+		sse_isa::rotate(n);
+	}
+
+	ISA_TARGET_AVX2 static void count_flips(const Perm* perms, int count) {
+		const __m256i index = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+		                                       0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		const __m256i zero = _mm256_setzero_si256();
+		// two registers of two permutations each, for two dependency chains
+		for (int k = 0; k < count; k += 4) {
+			__m128i lanes[4];
+			for (int l = 0; l < 4; ++l) {
+				// a zero permutation is already done, which pads the batch out
+				lanes[l] = k + l < count ? perms[k + l].perm : _mm_setzero_si128();
+			}
+			__m256i p1 = _mm256_inserti128_si256(_mm256_castsi128_si256(lanes[0]), lanes[1], 1);
+			__m256i p2 = _mm256_inserti128_si256(_mm256_castsi128_si256(lanes[2]), lanes[3], 1);
+			__m256i f1 = zero, f2 = zero;
+			for (;;) {
+				const __m256i t1 = _mm256_shuffle_epi8(p1, zero);
+				const __m256i t2 = _mm256_shuffle_epi8(p2, zero);
+				const __m256i either = _mm256_or_si256(t1, t2);
+				if (_mm256_testz_si256(either, either)) break;
+				p1 = _mm256_shuffle_epi8(p1, _mm256_blendv_epi8(_mm256_sub_epi8(t1, index), index, _mm256_cmpgt_epi8(index, t1)));
+				p2 = _mm256_shuffle_epi8(p2, _mm256_blendv_epi8(_mm256_sub_epi8(t2, index), index, _mm256_cmpgt_epi8(index, t2)));
+				// the comparison is -1 in the lanes still going
+				f1 = _mm256_sub_epi8(f1, _mm256_cmpgt_epi8(t1, zero));
+				f2 = _mm256_sub_epi8(f2, _mm256_cmpgt_epi8(t2, zero));
+			}
+			ALIGN_PREFIX(32) unsigned char flips[64] ALIGN_SUFFIX(32);
+			_mm256_store_si256((__m256i*)flips, f1);
+			_mm256_store_si256((__m256i*)(flips + 32), f2);
+			for (int l = 0; l < 4 && k + l < count; ++l) {
+				record_flips(perms[k + l], flips[16 * l]);
+			}
+		}
+	}
+};
+
+struct avx512_isa {
+	ISA_TARGET_AVX512 static void rotate(int n) {
+		sse_isa::rotate(n);
+	}
+
+	ISA_TARGET_AVX512 static void count_flips(const Perm* perms, int count) {
+		// 0 to 15 in every lane
+		const __m512i index = _mm512_set4_epi32(0x0f0e0d0c, 0x0b0a0908, 0x07060504, 0x03020100);
+		const __m512i zero = _mm512_setzero_si512();
+		const __m512i one = _mm512_set1_epi8(1);
+		// two registers of four permutations each
+		for (int k = 0; k < count; k += 8) {
+			ALIGN_PREFIX(64) __m128i lanes[8] ALIGN_SUFFIX(64);
+			for (int l = 0; l < 8; ++l) {
+				lanes[l] = k + l < count ? perms[k + l].perm : _mm_setzero_si128();
+			}
+			__m512i p1 = _mm512_load_si512(lanes);
+			__m512i p2 = _mm512_load_si512(lanes + 4);
+			__m512i f1 = zero, f2 = zero;
+			for (;;) {
+				const __m512i t1 = _mm512_shuffle_epi8(p1, zero);
+				const __m512i t2 = _mm512_shuffle_epi8(p2, zero);
+				const __mmask64 going1 = _mm512_test_epi8_mask(t1, t1);
+				const __mmask64 going2 = _mm512_test_epi8_mask(t2, t2);
+				if ((going1 | going2) == 0) break;
+				p1 = _mm512_shuffle_epi8(p1, _mm512_mask_blend_epi8(_mm512_cmpgt_epi8_mask(index, t1), _mm512_sub_epi8(t1, index), index));
+				p2 = _mm512_shuffle_epi8(p2, _mm512_mask_blend_epi8(_mm512_cmpgt_epi8_mask(index, t2), _mm512_sub_epi8(t2, index), index));
+				f1 = _mm512_mask_add_epi8(f1, going1, f1, one);
+				f2 = _mm512_mask_add_epi8(f2, going2, f2, one);
+			}
+			ALIGN_PREFIX(64) unsigned char flips[128] ALIGN_SUFFIX(64);
+			_mm512_store_si512(flips, f1);
+			_mm512_store_si512(flips + 64, f2);
+			for (int l = 0; l < 8 && k + l < count; ++l) {
+				record_flips(perms[k + l], flips[16 * l]);
+			}
+		}
+	}
+};
+
+long long factorial(int n) {
+	long long f = 1;
+	for (int i = 2; i <= n; ++i) f *= i;
+	return f;
+}
+
+// Puts permutation number index, in the order tk() generates them, in s,
+// and the counts that it would have got there with in c: index in the
+// factorial number system has c[i] as its digit of weight i!, and the
+// permutation is the identity with the first i+1 elements rotated c[i]
+// times, from the highest i down.
+void unrank(long long index, int n, elem* c) {
+	elem before[16];
+	for (int j = 0; j < 16; ++j) s[j] = j;
+	for (int i = n - 1; i > 0; --i) {
+		const long long f = factorial(i);
+		const int d = (int)(index / f);
+		index %= f;
+		c[i] = d;
+		std::memcpy(before, s, sizeof(before));
+		for (int j = 0; j <= i; ++j) s[j] = before[(j + d) % (i + 1)];
+	}
+	c[0] = 0;
+}
+
+// queues the permutation in s to have its flips counted, unless it takes
+// none, or just the one
+inline void queue_perm(Perm* perms, int& perm_max) {
+	if (*s) {
+		if (s[(int)s[0]]) {
+			perms[perm_max].perm = _mm_load_si128((__m128i*)s);
+			perms[perm_max].start = *s;
+			perms[perm_max].odd = odd;
+			perm_max++;
+		} else {
+			if (maxflips==0) maxflips = 1;
+			checksum += odd ? -1 : 1;
+		}
+	}
+}
+
+// the permutations numbered first to first+count-1
+template<typename isa>
+inline void tk_body(int n, long long first, long long count) {
+	// a place to put the backlog of permutations
+	Perm perms[60];
+
+	elem c[16] = {0};
+	int perm_max = 0;
+	unrank(first, n, c);
+	// the sign of the first, like every other, goes by its number's parity
+	odd = first % 2 ? ~0 : 0;
+	queue_perm(perms, perm_max);
+	long long left = count - 1;
+	int i = 1;
+	while (left > 0) {
+		/* Tompkin-Paige iterative perm generation */
+		// fill the queue up to 60
+		while (left > 0 && perm_max<60) {
+			isa::rotate(i);
+			if (c[i] >= i) {
+				c[i++] = 0;
+				continue;
+			}
+
+			c[i]++;
+			i = 1;
+			odd = ~odd;
+			--left;
+			queue_perm(perms, perm_max);
+		}
+		// process the queue
+		isa::count_flips(perms, perm_max);
 		perm_max = 0;
 	}
+	isa::count_flips(perms, perm_max);
 }
 
-int main(int argc, char **argv) {
-	high_resolution_timer timer;
+ISA_FLATTEN void tk_scalar(int n, long long first, long long count) {
+	tk_body<scalar_isa>(n, first, count);
+}
+
+ISA_TARGET_SSE ISA_FLATTEN void tk_sse(int n, long long first, long long count) {
+	tk_body<sse_isa>(n, first, count);
+}
 
-	int i;
-	popmasks();
+ISA_TARGET_AVX2 ISA_FLATTEN void tk_avx2(int n, long long first, long long count) {
+	tk_body<avx2_isa>(n, first, count);
+}
+
+ISA_TARGET_AVX512 ISA_FLATTEN void tk_avx512(int n, long long first, long long count) {
+	tk_body<avx512_isa>(n, first, count);
+}
+
+typedef void (*tk_fn)(int n, long long first, long long count);
+
+int main(int argc, char **argv) {
 	int n = (argc > 1) ? atoi(argv[1]) : 12;
 	if(n < 3 || n > 16)
 	{
 		printf("n should be between [3 and 16]\n");
 		return 0;
 	}
-	for (i = 0; i < n; i++) s[i] = i;
-	tk(n);
-	printf("%d\nPfannkuchen(%d) = %d\n", checksum, n, maxflips);
-
-	high_resolution_timer::duration dur = timer.pulse();
-
-	std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(dur).count() << std::endl;
-	return 0;
+	const tk_fn tk = select_isa<tk_fn>("tk", tk_scalar, tk_sse, tk_avx2, tk_avx512);
+	return run_benchmark([=]() {
+		popmasks();
+		// the n! permutations in up to 7! ranges of consecutive numbers,
+		// shared out among the threads; each range's checksum and maxflips
+		// are kept apart and added up in order
+		const long long total = factorial(n);
+		const int ranges = (int)std::min(total, factorial(7));
+		const long long size = (total + ranges - 1) / ranges;
+		std::vector<int> checksums(ranges), flips(ranges);
+#pragma omp parallel for schedule(dynamic, 1)
+		for (int k = 0; k < ranges; ++k) {
+			// tk() works on this thread's globals
+			maxflips = 0;
+			checksum = 0;
+			const long long first = k * size;
+			tk(n, first, std::min(size, total - first));
+			checksums[k] = checksum;
+			flips[k] = maxflips;
+		}
+		int sum = 0, most = 0;
+		for (int k = 0; k < ranges; ++k) {
+			sum += checksums[k];
+			most = std::max(most, flips[k]);
+		}
+		printf("%d\nPfannkuchen(%d) = %d\n", sum, n, most);
+	}, benchmark_options::from_environment().identify(argv[0], n));
 }
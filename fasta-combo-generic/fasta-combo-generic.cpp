@@ -19,7 +19,8 @@ modified by Peter Bright
 
 #include <boost/xpressive/xpressive.hpp>
 
-#include "timer.hpp"
+#include "runner.hpp"
+#include "regions.hpp"
 
 namespace {
 
@@ -79,12 +80,18 @@ namespace {
 			IUB(0.3015094502008f, 't')
 	});
 
+	int last_random = 42;
+
+	inline void reset_random()
+	{
+		last_random = 42;
+	}
+
 	inline float gen_random(float max = 1.0f)
 	{
 		static const int IM = 139968, IA = 3877, IC = 29573;
-		static int last = 42;
-		last = (last * IA + IC) % IM;
-		return max * last * (1.0f / IM);
+		last_random = (last_random * IA + IC) % IM;
+		return max * last_random * (1.0f / IM);
 	}
 
 	class Repeat {
@@ -156,9 +163,8 @@ namespace {
 } // end namespace
 
 void fasta(int iterations, const char* filename) {
-
-	make_cumulative(iub);
-	make_cumulative(homosapiens);
+	scoped_region region("fasta");
+	reset_random();
 
 	std::ofstream output(filename, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
 
@@ -198,6 +204,7 @@ void print_revcomp(Header const& header, Segment const& seg, std::ostream& out =
 }
 
 void reverse_complement(const char* filename) {
+	scoped_region region("reverse_complement");
 	std::ios_base::sync_with_stdio(false);
 
 	std::ifstream input(filename, std::ios_base::binary);
@@ -224,6 +231,7 @@ void reverse_complement(const char* filename) {
 namespace x = boost::xpressive;
 
 void regex_dna(const char* filename) {
+	scoped_region region("regex_dna");
 	std::ifstream fin(filename);
 	std::string str, line;
 	while(std::getline(fin, line)) {
@@ -286,15 +294,15 @@ void regex_dna(const char* filename) {
 
 int main(int argc, char *argv[])
 {
-	high_resolution_timer timer;
 	const int n = argc > 1 ? atoi(argv[1]) : 1000 * 1000;
 	const char* filename = "fasta.txt";
-	fasta(n, filename);
-	reverse_complement(filename);
-	regex_dna(filename);
 
-	high_resolution_timer::duration dur = timer.pulse();
+	make_cumulative(iub);
+	make_cumulative(homosapiens);
 
-	std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(dur).count() << std::endl;
-	return 0;
+	return run_benchmark([=]() {
+		fasta(n, filename);
+		reverse_complement(filename);
+		regex_dna(filename);
+	}, benchmark_options::from_environment().identify(argv[0], n).writes(filename).writes("fasta-reverse.txt"));
 }
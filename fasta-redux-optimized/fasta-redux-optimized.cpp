@@ -18,7 +18,7 @@
 #include <numeric>
 #include <initializer_list>
 
-#include "timer.hpp"
+#include "runner.hpp"
 
 namespace {
 
@@ -78,12 +78,18 @@ std::vector<IUB> homosapiens = initialize<std::vector<IUB>>(
 	IUB(0.3015094502008f, 't')
 });
 
+int last_random = 42;
+
+inline void reset_random()
+{
+	last_random = 42;
+}
+
 inline float gen_random(float max = 1.0f)
 {
 	static const int IM = 139968, IA = 3877, IC = 29573;
-	static int last = 42;
-	last = (last * IA + IC) % IM;
-	return max * last * (1.0f / IM);
+	last_random = (last_random * IA + IC) % IM;
+	return max * last_random * (1.0f / IM);
 }
 
 class Repeat {
@@ -153,17 +159,16 @@ void make(const char* id, const char* desc, int n, F functor)
 
 int main(int argc, char *argv[])
 {
-	high_resolution_timer timer;
 	const int n = argc > 1 ? atoi(argv[1]) : 100000;
 
 	make_cumulative(iub);
 	make_cumulative(homosapiens);
 
-	make("ONE"  , "Homo sapiens alu"      , n * 2, Repeat(alu));
-	make("TWO"  , "IUB ambiguity codes"   , n * 3, Random(iub));
-	make("THREE", "Homo sapiens frequency", n * 5, Random(homosapiens));
-
-	high_resolution_timer::duration dur = timer.pulse();
+	return run_benchmark([=]() {
+		reset_random();
 
-	std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(dur).count() << std::endl;
+		make("ONE"  , "Homo sapiens alu"      , n * 2, Repeat(alu));
+		make("TWO"  , "IUB ambiguity codes"   , n * 3, Random(iub));
+		make("THREE", "Homo sapiens frequency", n * 5, Random(homosapiens));
+	}, benchmark_options::from_environment().identify(argv[0], n));
 }
@@ -0,0 +1,313 @@
+#ifndef ALLOCATIONS_HPP
+#define ALLOCATIONS_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32) || defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// Allocation counting, compiled in by defining BENCH_ALLOCATIONS (the
+// Makefile's -alloc flavour does). The header then replaces the global
+// operator new and delete, and on glibc malloc, calloc, realloc, free and the
+// aligned allocators as well, so that C code, the standard library and the
+// OpenMP runtime are counted too. Sizes are the allocator's usable sizes,
+// which is what the process actually pays for.
+//
+// Each thread counts its own allocations without synchronisation, which is
+// what regions use; process-wide totals, live bytes and their high-water
+// mark are kept with atomic operations, so an instrumented build is slower
+// at allocating than a normal one and is not for timing.
+//
+// Without BENCH_ALLOCATIONS, or on a platform where it is not supported
+// (anything but glibc and Windows), allocations_tracked() is false and the
+// counts stay zero.
+
+#if defined(BENCH_ALLOCATIONS) && (defined(__GLIBC__) || defined(_WIN32))
+#define ALLOCATIONS_TRACKED 1
+#endif
+
+#if defined(_MSC_VER)
+#define ALLOCATIONS_THREAD_LOCAL __declspec(thread)
+#else
+#define ALLOCATIONS_THREAD_LOCAL __thread
+#endif
+
+struct allocation_counts {
+	unsigned long long allocations;
+	unsigned long long frees;
+	unsigned long long bytes; // allocated, never reduced by frees
+};
+
+namespace allocations_detail {
+	// plain zero-initialised data, so that allocations made before any
+	// constructor has run are counted rather than lost or overwritten
+	struct shared_counts {
+		volatile long long allocations;
+		volatile long long frees;
+		volatile long long bytes;
+		volatile long long live;
+		volatile long long peak;
+	};
+
+	inline shared_counts& shared() {
+		static shared_counts counts;
+		return counts;
+	}
+
+	inline allocation_counts& this_thread() {
+		static ALLOCATIONS_THREAD_LOCAL allocation_counts counts;
+		return counts;
+	}
+
+	inline long long atomic_add(volatile long long& target, long long delta) {
+#ifdef _MSC_VER
+		return _InterlockedExchangeAdd64(&target, delta) + delta;
+#else
+		return __sync_add_and_fetch(&target, delta);
+#endif
+	}
+
+	inline bool compare_exchange(volatile long long& target, long long expected, long long desired) {
+#ifdef _MSC_VER
+		return _InterlockedCompareExchange64(&target, desired, expected) == expected;
+#else
+		return __sync_bool_compare_and_swap(&target, expected, desired);
+#endif
+	}
+
+	inline void allocated(size_t bytes) {
+		allocation_counts& mine = this_thread();
+		++mine.allocations;
+		mine.bytes += bytes;
+		shared_counts& all = shared();
+		atomic_add(all.allocations, 1);
+		atomic_add(all.bytes, static_cast<long long>(bytes));
+		const long long live = atomic_add(all.live, static_cast<long long>(bytes));
+		long long peak = all.peak;
+		while(live > peak && !compare_exchange(all.peak, peak, live)) {
+			peak = all.peak;
+		}
+	}
+
+	inline void freed(size_t bytes) {
+		++this_thread().frees;
+		shared_counts& all = shared();
+		atomic_add(all.frees, 1);
+		atomic_add(all.live, -static_cast<long long>(bytes));
+	}
+}
+
+inline bool allocations_tracked() {
+#ifdef ALLOCATIONS_TRACKED
+	return true;
+#else
+	return false;
+#endif
+}
+
+// what the calling thread has allocated so far
+inline allocation_counts thread_allocations() {
+	return allocations_detail::this_thread();
+}
+
+// what every thread has allocated so far
+inline allocation_counts process_allocations() {
+	const allocations_detail::shared_counts& all = allocations_detail::shared();
+	allocation_counts counts;
+	counts.allocations = static_cast<unsigned long long>(all.allocations);
+	counts.frees = static_cast<unsigned long long>(all.frees);
+	counts.bytes = static_cast<unsigned long long>(all.bytes);
+	return counts;
+}
+
+inline long long live_bytes() {
+	return allocations_detail::shared().live;
+}
+
+inline long long peak_live_bytes() {
+	return allocations_detail::shared().peak;
+}
+
+// starts a new high-water mark from what is live now
+inline void reset_peak_live_bytes() {
+	allocations_detail::shared_counts& all = allocations_detail::shared();
+	all.peak = all.live;
+}
+
+#ifdef ALLOCATIONS_TRACKED
+
+#ifdef __GLIBC__
+
+// Everything goes through malloc and friends, including operator new below,
+// so only these count. glibc exports its own implementations under
+// __libc_ names for exactly this purpose.
+extern "C" {
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t count, size_t size);
+	void* __libc_realloc(void* block, size_t size);
+	void* __libc_memalign(size_t alignment, size_t size);
+	void* __libc_valloc(size_t size);
+	void* __libc_pvalloc(size_t size);
+	void __libc_free(void* block);
+
+	void* malloc(size_t size) __THROW {
+		void* block = __libc_malloc(size);
+		if(block) {
+			allocations_detail::allocated(malloc_usable_size(block));
+		}
+		return block;
+	}
+
+	void* calloc(size_t count, size_t size) __THROW {
+		void* block = __libc_calloc(count, size);
+		if(block) {
+			allocations_detail::allocated(malloc_usable_size(block));
+		}
+		return block;
+	}
+
+	void* realloc(void* block, size_t size) __THROW {
+		const size_t old_size = block ? malloc_usable_size(block) : 0;
+		void* moved = __libc_realloc(block, size);
+		if(moved || size == 0) {
+			if(block) {
+				allocations_detail::freed(old_size);
+			}
+			if(moved) {
+				allocations_detail::allocated(malloc_usable_size(moved));
+			}
+		}
+		return moved;
+	}
+
+	void free(void* block) __THROW {
+		if(block) {
+			allocations_detail::freed(malloc_usable_size(block));
+		}
+		__libc_free(block);
+	}
+
+	void* memalign(size_t alignment, size_t size) __THROW {
+		void* block = __libc_memalign(alignment, size);
+		if(block) {
+			allocations_detail::allocated(malloc_usable_size(block));
+		}
+		return block;
+	}
+
+	void* valloc(size_t size) __THROW {
+		void* block = __libc_valloc(size);
+		if(block) {
+			allocations_detail::allocated(malloc_usable_size(block));
+		}
+		return block;
+	}
+
+	void* pvalloc(size_t size) __THROW {
+		void* block = __libc_pvalloc(size);
+		if(block) {
+			allocations_detail::allocated(malloc_usable_size(block));
+		}
+		return block;
+	}
+
+	void* aligned_alloc(size_t alignment, size_t size) __THROW {
+		return memalign(alignment, size);
+	}
+
+	int posix_memalign(void** result, size_t alignment, size_t size) __THROW {
+		if(alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+			return EINVAL;
+		}
+		void* block = memalign(alignment, size);
+		if(!block) {
+			return ENOMEM;
+		}
+		*result = block;
+		return 0;
+	}
+}
+
+namespace allocations_detail {
+	inline void* counted_new(size_t size) {
+		void* block = std::malloc(size ? size : 1);
+		if(!block) {
+			throw std::bad_alloc();
+		}
+		return block;
+	}
+
+	inline void counted_delete(void* block) {
+		std::free(block);
+	}
+}
+
+#else // _WIN32
+
+namespace allocations_detail {
+	inline void* counted_new(size_t size) {
+		void* block = std::malloc(size ? size : 1);
+		if(!block) {
+			throw std::bad_alloc();
+		}
+		allocated(::_msize(block));
+		return block;
+	}
+
+	inline void counted_delete(void* block) {
+		if(block) {
+			freed(::_msize(block));
+		}
+		std::free(block);
+	}
+}
+
+#endif
+
+void* operator new(std::size_t size) {
+	return allocations_detail::counted_new(size);
+}
+
+void* operator new[](std::size_t size) {
+	return allocations_detail::counted_new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) throw() {
+	try {
+		return allocations_detail::counted_new(size);
+	} catch(std::bad_alloc&) {
+		return 0;
+	}
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) throw() {
+	try {
+		return allocations_detail::counted_new(size);
+	} catch(std::bad_alloc&) {
+		return 0;
+	}
+}
+
+void operator delete(void* block) throw() {
+	allocations_detail::counted_delete(block);
+}
+
+void operator delete[](void* block) throw() {
+	allocations_detail::counted_delete(block);
+}
+
+void operator delete(void* block, const std::nothrow_t&) throw() {
+	allocations_detail::counted_delete(block);
+}
+
+void operator delete[](void* block, const std::nothrow_t&) throw() {
+	allocations_detail::counted_delete(block);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,571 @@
+#ifndef BINARY_TREES_HPP
+#define BINARY_TREES_HPP
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "runner.hpp"
+#include "node_pools.hpp"
+
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#define BINARY_TREES_PREFETCH(p) _mm_prefetch(reinterpret_cast<const char*>(p), _MM_HINT_T0)
+#else
+#define BINARY_TREES_PREFETCH(p) __builtin_prefetch(p)
+#endif
+
+// What the binary-trees variants share: the node, the ways of checking a
+// tree of them, the layouts that keep a tree in one array, and the drivers
+// that choose between stores, layouts and checks and compare them. A
+// variant only supplies the kernel itself, as a type with
+//
+//   template<typename Store> static void pointer_trees(int min_depth, int max_depth, bool print);
+//   template<typename Tree> static void array_trees(int min_depth, int max_depth, bool print);
+//
+// the first building Nodes from a Store (see node_pools.hpp), the second
+// building bfs_trees or index_trees, and hands it to binary_trees_main():
+//
+//   BENCH_POOL    the store, or all to compare them         (object_pool)
+//   BENCH_LAYOUT  pointer, bfs, index, or all to compare them (pointer)
+//   BENCH_CHECK   how pointer trees are checked, see below,
+//                 or all to compare them                    (recursive)
+
+struct Node {
+	Node *l, *r;
+	int i;
+
+	Node(int i2) : l(0), r(0), i(i2) {
+	}
+	Node(Node *l2, int i2, Node *r2) : l(l2), r(r2), i(i2) {
+	}
+
+	int check() const {
+		if(l) {
+			return l->check() + i - r->check();
+		}
+		return i;
+	}
+};
+
+// nodes in a tree of depth d
+inline long long tree_nodes(int d) {
+	return (2LL << d) - 1;
+}
+
+// nodes built by one run of the kernel, stretch and long-lived trees included
+inline long long total_nodes(int min_depth, int max_depth) {
+	long long nodes = tree_nodes(max_depth + 1) + tree_nodes(max_depth);
+	for(int d = min_depth; d <= max_depth; d += 2) {
+		nodes += 2 * (1LL << (max_depth - d + min_depth)) * tree_nodes(d);
+	}
+	return nodes;
+}
+
+template<typename Store>
+Node* make(int i, int d, Store& store) {
+	if(d > 0) {
+		return store.construct(make(2 * i - 1, d - 1, store), i, make(2 * i, d - 1, store));
+	}
+	return store.construct(i);
+}
+
+// stores that do not give everything back at once get the nodes back one by one
+template<typename Store>
+void release(Node* n, Store& store) {
+	if(!Store::frees_objects) {
+		return;
+	}
+	if(n->l) {
+		release(n->l, store);
+		release(n->r, store);
+	}
+	store.destroy(n);
+}
+
+// How pointer trees are checked, chosen with BENCH_CHECK:
+//
+//   recursive    Node::check()
+//   iterative    a walk with an explicit stack, prefetching the children of
+//                each node it visits
+//   interleaved  eight such walks at once, a node of each in turn, so that
+//                a walk's prefetches have seven other nodes' time to arrive
+//                and the misses of all eight overlap: the trees of an
+//                iteration, or one big tree, split into subtrees near the
+//                root
+enum check_engine { recursive_check, iterative_check, interleaved_check, check_engines };
+
+inline const char* check_engine_name(int engine) {
+	static const char* const names[] = { "recursive", "iterative", "interleaved" };
+	return names[engine];
+}
+
+// the engine check_trees() uses
+inline check_engine& checking() {
+	static check_engine engine = recursive_check;
+	return engine;
+}
+
+// A depth-first walk over a tree. Each node still to visit is kept with the
+// sign its item counts with (negated once for every right turn on its path,
+// as check() subtracts right subtrees), as a mask that is all ones for a
+// negated item; the items are summed modulo 2^32, as the ints of check().
+class tree_walk {
+public:
+	unsigned int sum;
+
+	tree_walk() : sum(0), top(0) {
+	}
+
+	void start(const Node* root, unsigned int negate) {
+		push(root, negate);
+	}
+
+	bool done() const {
+		return top == 0;
+	}
+
+	// visits one node
+	void step() {
+		--top;
+		const Node* n = nodes[top];
+		const unsigned int negate = negations[top];
+		sum += (static_cast<unsigned int>(n->i) ^ negate) - negate;
+		if(n->l) {
+			BINARY_TREES_PREFETCH(n->l);
+			BINARY_TREES_PREFETCH(n->r);
+			push(n->r, ~negate);
+			push(n->l, negate);
+		}
+	}
+
+private:
+	// two a level, for any tree an int can count the nodes of
+	enum { capacity = 64 };
+	const Node* nodes[capacity];
+	unsigned int negations[capacity];
+	int top;
+
+	void push(const Node* n, unsigned int negate) {
+		nodes[top] = n;
+		negations[top] = negate;
+		++top;
+	}
+};
+
+// the sum of the checks of up to 8 trees
+inline int check_trees(const Node* const* roots, int count) {
+	enum { ways = 8 };
+	unsigned int sum = 0;
+	if(checking() == recursive_check) {
+		for(int k = 0; k < count; ++k) {
+			sum += static_cast<unsigned int>(roots[k]->check());
+		}
+		return static_cast<int>(sum);
+	}
+	if(checking() == iterative_check) {
+		for(int k = 0; k < count; ++k) {
+			tree_walk walk;
+			walk.start(roots[k], 0);
+			while(!walk.done()) {
+				walk.step();
+			}
+			sum += walk.sum;
+		}
+		return static_cast<int>(sum);
+	}
+
+	// the items nearest the roots are added here, to split the trees into
+	// as many subtrees as there are ways
+	const Node* tops[ways];
+	unsigned int negations[ways];
+	int n = count;
+	for(int k = 0; k < count; ++k) {
+		tops[k] = roots[k];
+		negations[k] = 0;
+	}
+	while(2 * n <= ways) {
+		const Node* below[ways];
+		unsigned int below_negations[ways];
+		int m = 0;
+		for(int k = 0; k < n; ++k) {
+			const Node* t = tops[k];
+			const unsigned int negate = negations[k];
+			if(t->l) {
+				sum += (static_cast<unsigned int>(t->i) ^ negate) - negate;
+				below[m] = t->l;
+				below_negations[m++] = negate;
+				below[m] = t->r;
+				below_negations[m++] = ~negate;
+			} else {
+				below[m] = t;
+				below_negations[m++] = negate;
+			}
+		}
+		if(m == n) {
+			break;
+		}
+		for(int k = 0; k < m; ++k) {
+			tops[k] = below[k];
+			negations[k] = below_negations[k];
+		}
+		n = m;
+	}
+
+	tree_walk walks[ways];
+	for(int k = 0; k < n; ++k) {
+		walks[k].start(tops[k], negations[k]);
+	}
+	for(int live = n; live > 0; ) {
+		live = 0;
+		for(int k = 0; k < n; ++k) {
+			if(!walks[k].done()) {
+				walks[k].step();
+				++live;
+			}
+		}
+	}
+	for(int k = 0; k < n; ++k) {
+		sum += walks[k].sum;
+	}
+	return static_cast<int>(sum);
+}
+
+inline int check_tree(const Node* root) {
+	return check_trees(&root, 1);
+}
+
+// Layouts that keep a tree in one array, chosen with BENCH_LAYOUT. A tree
+// keeps its array from one build to the next, so building again costs no
+// allocation.
+//
+// bfs: a tree is perfect, so it can be kept breadth first, the children of
+// item k at 2k+1 and 2k+2, with nothing but the 4-byte items; build and
+// check then go through memory in order instead of chasing pointers.
+class bfs_tree {
+public:
+	void build(int i, int d) {
+		items.resize(static_cast<size_t>(tree_nodes(d)));
+		items[0] = i;
+		for(size_t k = 0; 2 * k + 2 < items.size(); ++k) {
+			items[2 * k + 1] = 2 * items[k] - 1;
+			items[2 * k + 2] = 2 * items[k];
+		}
+	}
+
+	// Node::check() adds the left subtree and subtracts the right one, so
+	// each item counts once, negated if its path from the root turns right
+	// an odd number of times: if its position in its level has odd parity.
+	// Summed modulo 2^32, like the recursion's ints, whatever the order.
+	int check() const {
+		unsigned int sum = 0;
+		size_t first = 0;
+		for(size_t width = 1; first < items.size(); first += width, width *= 2) {
+			for(size_t j = 0; j < width; ++j) {
+				const unsigned int item = static_cast<unsigned int>(items[first + j]);
+				sum += parity(static_cast<unsigned int>(j)) ? 0u - item : item;
+			}
+		}
+		return static_cast<int>(sum);
+	}
+
+private:
+	std::vector<int, buffer_allocator<int> > items;
+
+	static unsigned int parity(unsigned int x) {
+		x ^= x >> 16;
+		x ^= x >> 8;
+		x ^= x >> 4;
+		return (0x6996 >> (x & 15)) & 1;
+	}
+};
+
+// index: Node's shape, with the children named by their 32-bit index in
+// the tree's array of nodes instead of by pointer; 12 bytes a node rather
+// than 24, and the indices stay good if the array moves.
+struct IndexNode {
+	unsigned int l, r;
+	int i;
+};
+
+class index_tree {
+public:
+	// item 0 stands for no child
+	index_tree() : nodes(1), root(0) {
+	}
+
+	void build(int i, int d) {
+		nodes.resize(1);
+		nodes.reserve(static_cast<size_t>(tree_nodes(d)) + 1);
+		root = make(i, d);
+	}
+
+	int check() const {
+		return check(&nodes[0], root);
+	}
+
+private:
+	std::vector<IndexNode, buffer_allocator<IndexNode> > nodes;
+	unsigned int root;
+
+	unsigned int make(int i, int d) {
+		IndexNode n = { 0, 0, i };
+		if(d > 0) {
+			n.l = make(2 * i - 1, d - 1);
+			n.r = make(2 * i, d - 1);
+		}
+		nodes.push_back(n);
+		return static_cast<unsigned int>(nodes.size() - 1);
+	}
+
+	static int check(const IndexNode* base, unsigned int n) {
+		const IndexNode& node = base[n];
+		if(node.l) {
+			return check(base, node.l) + node.i - check(base, node.r);
+		}
+		return node.i;
+	}
+};
+
+namespace binary_trees_detail {
+	// what the thread-arena stores of every thread kept goes back, so that
+	// the next store does not start out holding it
+	inline void release_regions() {
+		release_thread_regions<Node>();
+#ifdef _OPENMP
+#pragma omp parallel
+		release_thread_regions<Node>();
+#endif
+	}
+
+	template<typename Kernel>
+	struct run_with_store {
+		int min_depth, max_depth;
+		benchmark_options options;
+		int status;
+
+		template<typename Store> void visit() {
+			const int min_d = min_depth, max_d = max_depth;
+			status = run_benchmark([=]() {
+				Kernel::template pointer_trees<Store>(min_d, max_d, true);
+			}, options);
+		}
+	};
+
+	// peak is what the store held at most beyond what was already held when
+	// it started, since some stores keep their memory for good
+	template<typename Kernel>
+	struct time_store {
+		int min_depth, max_depth;
+		benchmark_options options;
+		benchmark_statistics stats;
+		long long peak;
+
+		template<typename Store> void visit() {
+			const int min_d = min_depth, max_d = max_depth;
+			const long long base = pool_bytes();
+			reset_peak_pool_bytes();
+			stats = measure([=]() {
+				Kernel::template pointer_trees<Store>(min_d, max_d, false);
+			}, options);
+			peak = peak_pool_bytes() - base;
+			release_regions();
+		}
+	};
+
+	// the trees once, as usual, from the named store
+	template<typename Kernel>
+	int run_once(int min_depth, int max_depth, const std::string& store, const benchmark_options& options) {
+		run_with_store<Kernel> run = { min_depth, max_depth, options, 0 };
+		with_node_pool<Node>(store, run);
+		return run.status;
+	}
+
+	template<typename Kernel>
+	time_store<Kernel> time_with(int min_depth, int max_depth, const std::string& store, const benchmark_options& options) {
+		time_store<Kernel> timed = { min_depth, max_depth, options, benchmark_statistics(), 0 };
+		with_node_pool<Node>(store, timed);
+		return timed;
+	}
+
+	inline void emit_named(const benchmark_statistics& stats, const benchmark_options& options, const std::string& name) {
+		benchmark_options named = options;
+		named.program += "-" + name;
+		emit_result(stats, named);
+	}
+}
+
+// BENCH_POOL=all: the trees once with the default store, as usual, then
+// every store timed in turn and compared side by side on stderr, with the
+// most memory each held beyond what was held before it ran. Each store also
+// gets a result record, as variant <variant>-<store>.
+template<typename Kernel>
+int compare_stores(int min_depth, int max_depth, const benchmark_options& options) {
+	using namespace binary_trees_detail;
+	const int status = run_once<Kernel>(min_depth, max_depth, "object_pool", options);
+
+	const double nodes = static_cast<double>(total_nodes(min_depth, max_depth));
+	std::ostream& os = std::cerr;
+	std::ios_base::fmtflags flags = os.flags();
+	os << std::fixed << std::setprecision(1)
+	   << std::left << std::setw(16) << "store" << std::right
+	   << std::setw(12) << "median ms" << std::setw(12) << "Mnodes/s" << std::setw(16) << "peak +MiB" << "\n";
+	for(size_t i = 0; i < node_pool_names().size(); ++i) {
+		const std::string& name = node_pool_names()[i];
+		const time_store<Kernel> timed = time_with<Kernel>(min_depth, max_depth, name, options);
+		os << std::left << std::setw(16) << name << std::right
+		   << std::setw(12) << timed.stats.median / 1000.0
+		   << std::setw(12) << nodes / timed.stats.median
+		   << std::setw(16) << timed.peak / 1048576.0 << "\n";
+		emit_named(timed.stats, options, name);
+	}
+	os << "peak +MiB: the most held beyond what was held before the store ran\n";
+	os.flags(flags);
+	return status;
+}
+
+// BENCH_LAYOUT=all: the trees once with pointers, as usual, then every
+// layout timed and compared side by side on stderr, with the bytes each
+// keeps per node and the rate at which building writes and checking reads
+// them. The pointer layout uses the BENCH_POOL store. The array layouts also
+// get result records, as variant <variant>-<layout>.
+template<typename Kernel>
+int compare_layouts(int min_depth, int max_depth, const std::string& store, const benchmark_options& options) {
+	using namespace binary_trees_detail;
+	const int status = run_once<Kernel>(min_depth, max_depth, store, options);
+
+	const time_store<Kernel> pointers = time_with<Kernel>(min_depth, max_depth, store, options);
+	const int min_d = min_depth, max_d = max_depth;
+	const benchmark_statistics bfs = measure([=]() {
+		Kernel::template array_trees<bfs_tree>(min_d, max_d, false);
+	}, options);
+	const benchmark_statistics index = measure([=]() {
+		Kernel::template array_trees<index_tree>(min_d, max_d, false);
+	}, options);
+
+	const double nodes = static_cast<double>(total_nodes(min_depth, max_depth));
+	const benchmark_statistics* stats[] = { &pointers.stats, &bfs, &index };
+	const char* const names[] = { "pointer", "bfs", "index" };
+	const size_t bytes[] = { sizeof(Node), sizeof(int), sizeof(IndexNode) };
+	std::ostream& os = std::cerr;
+	std::ios_base::fmtflags flags = os.flags();
+	os << std::fixed << std::setprecision(1)
+	   << std::left << std::setw(16) << "layout" << std::right
+	   << std::setw(12) << "median ms" << std::setw(12) << "Mnodes/s"
+	   << std::setw(12) << "bytes/node" << std::setw(12) << "node MB/s" << std::setw(12) << "speedup" << "\n";
+	for(int l = 0; l < 3; ++l) {
+		os << std::left << std::setw(16) << names[l] << std::right
+		   << std::setw(12) << stats[l]->median / 1000.0
+		   << std::setw(12) << nodes / stats[l]->median
+		   << std::setw(12) << bytes[l]
+		   << std::setw(12) << 2.0 * nodes * bytes[l] / stats[l]->median
+		   << std::setw(12) << pointers.stats.median / stats[l]->median << "\n";
+		if(l > 0) {
+			emit_named(*stats[l], options, names[l]);
+		}
+	}
+	os.flags(flags);
+	return status;
+}
+
+// BENCH_CHECK=all: the trees once, checked recursively as usual, then each
+// way of checking timed with the BENCH_POOL store and compared side by side
+// on stderr. Each also gets a result record, as variant <variant>-<check>.
+template<typename Kernel>
+int compare_checks(int min_depth, int max_depth, const std::string& store, const benchmark_options& options) {
+	using namespace binary_trees_detail;
+	checking() = recursive_check;
+	const int status = run_once<Kernel>(min_depth, max_depth, store, options);
+
+	const double nodes = static_cast<double>(total_nodes(min_depth, max_depth));
+	std::ostream& os = std::cerr;
+	std::ios_base::fmtflags flags = os.flags();
+	os << std::fixed << std::setprecision(1)
+	   << std::left << std::setw(16) << "check" << std::right
+	   << std::setw(12) << "median ms" << std::setw(12) << "Mnodes/s" << std::setw(12) << "speedup" << "\n";
+	double recursive = 0.0;
+	for(int e = 0; e < check_engines; ++e) {
+		checking() = static_cast<check_engine>(e);
+		const time_store<Kernel> timed = time_with<Kernel>(min_depth, max_depth, store, options);
+		if(e == recursive_check) {
+			recursive = timed.stats.median;
+		}
+		os << std::left << std::setw(16) << check_engine_name(e) << std::right
+		   << std::setw(12) << timed.stats.median / 1000.0
+		   << std::setw(12) << nodes / timed.stats.median
+		   << std::setw(12) << recursive / timed.stats.median << "\n";
+		emit_named(timed.stats, options, check_engine_name(e));
+	}
+	checking() = recursive_check;
+	os.flags(flags);
+	return status;
+}
+
+// the problem size from argv, the store, layout and check from the
+// environment; returns the exit status
+template<typename Kernel>
+int binary_trees_main(int argc, char* argv[]) {
+	const int min_depth = 4;
+	const int max_depth = std::max(min_depth + 2, (argc == 2 ? atoi(argv[1]) : 20));
+
+	const benchmark_options options = benchmark_options::from_environment().identify(argv[0], max_depth);
+	const char* pool = std::getenv("BENCH_POOL");
+	const std::string store = pool && *pool ? pool : "object_pool";
+	const char* layout_name = std::getenv("BENCH_LAYOUT");
+	const std::string layout = layout_name && *layout_name ? layout_name : "pointer";
+	const char* check_name = std::getenv("BENCH_CHECK");
+	const std::string check = check_name && *check_name ? check_name : "recursive";
+	int engine = 0;
+	while(engine < check_engines && check != check_engine_name(engine)) {
+		++engine;
+	}
+	if(engine == check_engines && check != "all") {
+		std::cerr << "unknown BENCH_CHECK " << check << "; one of recursive, iterative, interleaved, all" << std::endl;
+		return 2;
+	}
+	if(check != "all") {
+		checking() = static_cast<check_engine>(engine);
+	}
+	if(layout == "bfs") {
+		return run_benchmark([=]() {
+			Kernel::template array_trees<bfs_tree>(min_depth, max_depth, true);
+		}, options);
+	}
+	if((layout == "index" || layout == "all") && tree_nodes(max_depth + 1) >= (1LL << 32)) {
+		std::cerr << "trees of depth " << max_depth + 1 << " have too many nodes for 32-bit indices" << std::endl;
+		return 2;
+	}
+	if(layout == "index") {
+		return run_benchmark([=]() {
+			Kernel::template array_trees<index_tree>(min_depth, max_depth, true);
+		}, options);
+	}
+	if(layout != "pointer" && layout != "all") {
+		std::cerr << "unknown BENCH_LAYOUT " << layout << "; one of pointer, bfs, index, all" << std::endl;
+		return 2;
+	}
+	const std::vector<std::string>& stores = node_pool_names();
+	if(store != "all" && std::find(stores.begin(), stores.end(), store) == stores.end()) {
+		std::cerr << "unknown BENCH_POOL " << store << "; one of all";
+		for(size_t i = 0; i < stores.size(); ++i) {
+			std::cerr << ", " << stores[i];
+		}
+		std::cerr << std::endl;
+		return 2;
+	}
+	if(check == "all") {
+		return compare_checks<Kernel>(min_depth, max_depth, store == "all" ? "object_pool" : store, options);
+	}
+	if(layout == "all") {
+		return compare_layouts<Kernel>(min_depth, max_depth, store == "all" ? "object_pool" : store, options);
+	}
+	if(store == "all") {
+		return compare_stores<Kernel>(min_depth, max_depth, options);
+	}
+	return binary_trees_detail::run_once<Kernel>(min_depth, max_depth, store, options);
+}
+
+#endif
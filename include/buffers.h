@@ -0,0 +1,918 @@
+#ifndef BUFFERS_H
+#define BUFFERS_H
+
+/* Aligned buffers for the kernels' large working sets, usable from both the
+ * C and the C++ kernels.
+ *
+ * bench_buffer_alloc() returns memory aligned to at least a cache line (and
+ * so to any SIMD register). Buffers of a huge page or more are mapped
+ * straight from the operating system, aligned to the huge page size, so
+ * that they can be backed by huge pages and take far fewer TLB misses:
+ *
+ *   BENCH_PAGES      transparent - advise the kernel to back the buffer with
+ *                                  transparent huge pages  (default)
+ *                    huge        - reserved huge pages (MAP_HUGETLB; large
+ *                                  pages on Windows), falling back to
+ *                                  transparent ones if none are free
+ *                    small       - small pages, transparent huge pages
+ *                                  advised against
+ *                    heap        - everything from the C heap, as before
+ *   BENCH_NUMA       which NUMA nodes the pages of large buffers go to:
+ *                    first-touch - the node of the thread that first writes
+ *                                  each page, whatever the process's own
+ *                                  policy; kernels fill their buffers from
+ *                                  the threads that go on to use them
+ *                    interleave  - round robin over the nodes with memory
+ *                    bind        - all on BENCH_NUMA_NODE
+ *                                  (the process's policy, normally first touch)
+ *   BENCH_NUMA_NODE  the node for bind; set alone, it implies bind  (0)
+ *
+ * bench_buffer_alloc_on_node() binds a buffer to one node whatever the
+ * policy, for memory that belongs to the threads of that node.
+ *
+ * When a NUMA policy is set, or the machine has more than one node with
+ * memory, the nodes of a sample of each mapped buffer's pages are read with
+ * move_pages(2) as it is freed and added up per node, so the report shows
+ * where the memory really was.
+ * bench_numa_placement() reads the node of every page of a kernel's arrays
+ * while they are still in use, and which of them are local to their thread.
+ *
+ * Reserved huge pages are not always available, and transparent ones are
+ * only a request, so what was actually obtained is recorded: a transparent
+ * buffer's huge page count is read from /proc/self/smaps when it is freed.
+ * bench_buffer_summary() describes it, bench_result_buffers() adds it to a
+ * result record. The contents of a new buffer are unspecified.
+ *
+ * C++ code can put a buffer_allocator<T> in a std::vector.
+ *
+ * Everything is static/inline so the header can be included without a
+ * separate translation unit.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "results.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <malloc.h>
+#define BUFFERS_WINDOWS 1
+#elif defined(__linux__) && !defined(EMSCRIPTEN)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define BUFFERS_MMAP 1
+#elif !defined(EMSCRIPTEN)
+#include <sys/mman.h>
+#include <unistd.h>
+#define BUFFERS_MMAP 1
+#endif
+
+#if defined(BUFFERS_MMAP) && !defined(MAP_ANONYMOUS)
+#if defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#else
+/* a strict -std= hides anonymous mappings; use the heap */
+#undef BUFFERS_MMAP
+#endif
+#endif
+
+#if defined(__cplusplus)
+#define BUFFERS_API inline
+#elif defined(_MSC_VER)
+#define BUFFERS_API static __inline
+#else
+#define BUFFERS_API static __inline__
+#endif
+
+#define BENCH_BUFFER_ALIGNMENT 64
+/* most buffers mapped from the operating system live at once */
+#define BENCH_BUFFER_MAPPINGS 256
+#define BENCH_NUMA_MAX_NODES 64
+/* lines bench_buffer_lines() may produce */
+#define BENCH_BUFFER_LINES (BENCH_BACKING_COUNT + 3 + BENCH_NUMA_MAX_NODES)
+
+enum bench_backing {
+	BENCH_BACKING_HEAP,        /* the C heap */
+	BENCH_BACKING_SMALL,       /* mapped, small pages */
+	BENCH_BACKING_TRANSPARENT, /* mapped, transparent huge pages advised */
+	BENCH_BACKING_HUGE,        /* mapped from reserved huge (large) pages */
+	BENCH_BACKING_COUNT
+};
+
+enum bench_page_policy {
+	BENCH_PAGES_HEAP,
+	BENCH_PAGES_SMALL,
+	BENCH_PAGES_TRANSPARENT,
+	BENCH_PAGES_HUGE
+};
+
+enum bench_numa_policy {
+	BENCH_NUMA_DEFAULT, /* the process's own */
+	BENCH_NUMA_FIRST_TOUCH,
+	BENCH_NUMA_INTERLEAVE,
+	BENCH_NUMA_BIND
+};
+
+typedef struct bench_buffer_mapping {
+	char* address;
+	size_t mapped;
+	int backing;
+} bench_buffer_mapping;
+
+typedef struct bench_buffer_statistics {
+	long long buffers[BENCH_BACKING_COUNT];
+	long long bytes[BENCH_BACKING_COUNT];
+	/* of the transparent buffers freed so far, how much was huge */
+	long long freed_transparent;
+	long long freed_transparent_huge;
+	/* reserved huge pages asked for but not there */
+	long long huge_fallbacks;
+	int numa_policy;
+	int numa_node;
+	long long numa_applied;
+	long long numa_failed;
+	int numa_error;
+	/* sampled placement of the mapped buffers freed so far */
+	long long node_bytes[BENCH_NUMA_MAX_NODES];
+	long long unplaced_bytes;
+} bench_buffer_statistics;
+
+typedef struct bench_buffer_state {
+	volatile long lock;
+	int initialized;
+	int policy;
+	int numa_policy;
+	int numa_node;
+	unsigned long memory_nodes[BENCH_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+	int memory_node_count;
+	size_t huge_page;
+	bench_buffer_mapping mappings[BENCH_BUFFER_MAPPINGS];
+	bench_buffer_statistics statistics;
+} bench_buffer_state;
+
+BUFFERS_API bench_buffer_state* buffers_state(void)
+{
+	static bench_buffer_state state;
+	return &state;
+}
+
+/* allocations are few and large, so a spin lock is plenty */
+BUFFERS_API void buffers_lock(bench_buffer_state* state)
+{
+#if defined(_MSC_VER)
+	while(InterlockedExchange(&state->lock, 1)) {
+		Sleep(0);
+	}
+#else
+	while(__sync_lock_test_and_set(&state->lock, 1)) {
+	}
+#endif
+}
+
+BUFFERS_API void buffers_unlock(bench_buffer_state* state)
+{
+#if defined(_MSC_VER)
+	InterlockedExchange(&state->lock, 0);
+#else
+	__sync_lock_release(&state->lock);
+#endif
+}
+
+BUFFERS_API const char* bench_backing_name(int backing)
+{
+	static const char* const names[] = { "heap", "small pages", "transparent huge pages", "huge pages" };
+	return backing >= 0 && backing < BENCH_BACKING_COUNT ? names[backing] : "unknown";
+}
+
+BUFFERS_API const char* bench_numa_policy_name(int policy)
+{
+	static const char* const names[] = { "default", "first-touch", "interleave", "bind" };
+	return policy >= 0 && policy <= BENCH_NUMA_BIND ? names[policy] : "unknown";
+}
+
+/* the nodes that have memory, from a list like "0-1,3"; node 0 alone if
+ * there is no telling */
+BUFFERS_API void buffers_find_memory_nodes(bench_buffer_state* state)
+{
+	const int bits = 8 * (int)sizeof(unsigned long);
+	char list[1024] = "0";
+#if defined(__linux__)
+	FILE* f = fopen("/sys/devices/system/node/has_memory", "r");
+	if(!f) {
+		f = fopen("/sys/devices/system/node/online", "r");
+	}
+	if(f) {
+		if(!fgets(list, sizeof(list), f)) {
+			strcpy(list, "0");
+		}
+		fclose(f);
+	}
+#elif defined(BUFFERS_WINDOWS)
+	ULONG highest = 0;
+	if(GetNumaHighestNodeNumber(&highest)) {
+		sprintf(list, "0-%lu", highest);
+	}
+#endif
+	{
+		const char* p = list;
+		while(*p >= '0' && *p <= '9') {
+			char* end;
+			int first = (int)strtol(p, &end, 10);
+			int last = first;
+			int node;
+			if(*end == '-') {
+				last = (int)strtol(end + 1, &end, 10);
+			}
+			for(node = first; node <= last && node < BENCH_NUMA_MAX_NODES; ++node) {
+				state->memory_nodes[node / bits] |= 1ul << (node % bits);
+				++state->memory_node_count;
+			}
+			p = *end == ',' ? end + 1 : end;
+		}
+	}
+	if(state->memory_node_count == 0) {
+		state->memory_nodes[0] = 1;
+		state->memory_node_count = 1;
+	}
+}
+
+/* called with the lock held */
+BUFFERS_API void buffers_initialize(bench_buffer_state* state)
+{
+	const char* pages = getenv("BENCH_PAGES");
+	const char* numa = getenv("BENCH_NUMA");
+	const char* node = getenv("BENCH_NUMA_NODE");
+	if(state->initialized) {
+		return;
+	}
+	state->initialized = 1;
+	state->policy = BENCH_PAGES_TRANSPARENT;
+	if(pages && strcmp(pages, "heap") == 0) {
+		state->policy = BENCH_PAGES_HEAP;
+	} else if(pages && strcmp(pages, "small") == 0) {
+		state->policy = BENCH_PAGES_SMALL;
+	} else if(pages && strcmp(pages, "huge") == 0) {
+		state->policy = BENCH_PAGES_HUGE;
+	}
+	state->numa_policy = BENCH_NUMA_DEFAULT;
+	if(numa && strcmp(numa, "first-touch") == 0) {
+		state->numa_policy = BENCH_NUMA_FIRST_TOUCH;
+	} else if(numa && strcmp(numa, "interleave") == 0) {
+		state->numa_policy = BENCH_NUMA_INTERLEAVE;
+	} else if((numa && strcmp(numa, "bind") == 0) || (!numa && node && *node)) {
+		state->numa_policy = BENCH_NUMA_BIND;
+	}
+	state->numa_node = node && *node ? atoi(node) : 0;
+	state->statistics.numa_policy = state->numa_policy;
+	state->statistics.numa_node = state->numa_node;
+	buffers_find_memory_nodes(state);
+	state->huge_page = 2u << 20;
+#if defined(BUFFERS_WINDOWS)
+	if(GetLargePageMinimum() > 0) {
+		state->huge_page = GetLargePageMinimum();
+	}
+#elif defined(__linux__)
+	{
+		FILE* meminfo = fopen("/proc/meminfo", "r");
+		char line[256];
+		unsigned long kib;
+		while(meminfo && fgets(line, sizeof(line), meminfo)) {
+			if(sscanf(line, "Hugepagesize: %lu kB", &kib) == 1 && kib > 0) {
+				state->huge_page = (size_t)kib << 10;
+			}
+		}
+		if(meminfo) {
+			fclose(meminfo);
+		}
+	}
+#endif
+}
+
+#if defined(__linux__) && defined(BUFFERS_MMAP)
+/* a NUMA policy as mbind(2), without linking libnuma */
+BUFFERS_API int buffers_place(bench_buffer_state* state, void* address, size_t length, int policy, int node)
+{
+	const int bits = 8 * (int)sizeof(unsigned long);
+	const int mpol_bind = 2, mpol_interleave = 3, mpol_local = 4;
+	unsigned long mask[BENCH_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+	/* the kernel reads one bit fewer than it is told */
+	const unsigned long max_node = BENCH_NUMA_MAX_NODES + 1;
+	switch(policy) {
+	case BENCH_NUMA_FIRST_TOUCH:
+		return (int)syscall(SYS_mbind, address, length, mpol_local, 0, 0, 0);
+	case BENCH_NUMA_INTERLEAVE:
+		return (int)syscall(SYS_mbind, address, length, mpol_interleave, state->memory_nodes, max_node, 0);
+	case BENCH_NUMA_BIND:
+		if(node < 0 || node >= BENCH_NUMA_MAX_NODES) {
+			errno = EINVAL;
+			return -1;
+		}
+		memset(mask, 0, sizeof(mask));
+		mask[node / bits] = 1ul << (node % bits);
+		return (int)syscall(SYS_mbind, address, length, mpol_bind, mask, max_node, 0);
+	default:
+		return 0;
+	}
+}
+
+/* adds up the nodes of a sample of a mapping's pages; pages never touched
+ * have none */
+BUFFERS_API void buffers_record_placement(bench_buffer_state* state, char* address, size_t length)
+{
+	enum { samples = 512 };
+	void* pages[samples];
+	int status[samples];
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t step = length / samples / page * page;
+	unsigned long count = 0;
+	unsigned long i;
+	if(step < page) {
+		step = page;
+	}
+	for(i = 0; i < samples && i * step < length; ++i) {
+		pages[count++] = address + i * step;
+	}
+	if(syscall(SYS_move_pages, 0, count, pages, 0, status, 0) != 0) {
+		return;
+	}
+	for(i = 0; i < count; ++i) {
+		const size_t bytes = i + 1 < count ? step : length - i * step;
+		if(status[i] >= 0 && status[i] < BENCH_NUMA_MAX_NODES) {
+			state->statistics.node_bytes[status[i]] += (long long)bytes;
+		} else {
+			state->statistics.unplaced_bytes += (long long)bytes;
+		}
+	}
+}
+
+/* how much of a mapping is currently backed by transparent huge pages,
+ * according to the smaps entry of the area that contains it */
+BUFFERS_API size_t buffers_huge_bytes(const char* address, size_t length)
+{
+	FILE* smaps = fopen("/proc/self/smaps", "r");
+	char line[512];
+	unsigned long start, end, kib;
+	int inside = 0;
+	size_t huge = 0;
+	if(!smaps) {
+		return 0;
+	}
+	while(fgets(line, sizeof(line), smaps)) {
+		if(sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			inside = (unsigned long)address >= start && (unsigned long)address < end;
+		} else if(inside && sscanf(line, "AnonHugePages: %lu kB", &kib) == 1) {
+			huge = (size_t)kib << 10;
+			break;
+		}
+	}
+	fclose(smaps);
+	return huge < length ? huge : length;
+}
+#endif
+
+/* maps length bytes, huge-page aligned; 0 if that fails */
+BUFFERS_API char* buffers_map(bench_buffer_state* state, size_t length, int* backing, int policy, int node)
+{
+#if defined(BUFFERS_WINDOWS)
+	char* p = 0;
+	if(*backing == BENCH_BACKING_HUGE) {
+		if(policy == BENCH_NUMA_BIND) {
+			p = (char*)VirtualAllocExNuma(GetCurrentProcess(), 0, length, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, (DWORD)node);
+		} else {
+			p = (char*)VirtualAlloc(0, length, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		}
+		if(p) {
+			return p;
+		}
+		/* large pages need SeLockMemoryPrivilege */
+		++state->statistics.huge_fallbacks;
+	}
+	/* Windows has no transparent huge pages */
+	*backing = BENCH_BACKING_SMALL;
+	if(policy == BENCH_NUMA_BIND) {
+		return (char*)VirtualAllocExNuma(GetCurrentProcess(), 0, length, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, (DWORD)node);
+	}
+	return (char*)VirtualAlloc(0, length, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#elif defined(BUFFERS_MMAP)
+	char* p;
+	char* aligned;
+	size_t head;
+	/* placement is done afterwards, by buffers_place */
+	(void)policy;
+	(void)node;
+#if defined(MAP_HUGETLB)
+	if(*backing == BENCH_BACKING_HUGE) {
+		p = (char*)mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(p != MAP_FAILED) {
+			return p;
+		}
+		++state->statistics.huge_fallbacks;
+	}
+#endif
+	if(*backing == BENCH_BACKING_HUGE) {
+		*backing = BENCH_BACKING_TRANSPARENT;
+	}
+	/* over-allocate by a huge page and trim, so that the buffer starts on a
+	 * huge page boundary and every page of it can be huge */
+	p = (char*)mmap(0, length + state->huge_page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED) {
+		return 0;
+	}
+	aligned = (char*)(((size_t)p + state->huge_page - 1) & ~(state->huge_page - 1));
+	head = (size_t)(aligned - p);
+	if(head) {
+		munmap(p, head);
+	}
+	if(state->huge_page - head) {
+		munmap(aligned + length, state->huge_page - head);
+	}
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+	madvise(aligned, length, *backing == BENCH_BACKING_TRANSPARENT ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+#else
+	*backing = BENCH_BACKING_SMALL;
+#endif
+	return aligned;
+#else
+	(void)state;
+	(void)length;
+	(void)backing;
+	(void)policy;
+	(void)node;
+	return 0;
+#endif
+}
+
+BUFFERS_API void buffers_unmap(bench_buffer_mapping* mapping)
+{
+#if defined(BUFFERS_WINDOWS)
+	VirtualFree(mapping->address, 0, MEM_RELEASE);
+#elif defined(BUFFERS_MMAP)
+	munmap(mapping->address, mapping->mapped);
+#else
+	(void)mapping;
+#endif
+}
+
+BUFFERS_API void* buffers_heap_alloc(size_t bytes)
+{
+#if defined(_WIN32)
+	return _aligned_malloc(bytes ? bytes : 1, BENCH_BUFFER_ALIGNMENT);
+#else
+	void* p = 0;
+	if(posix_memalign(&p, BENCH_BUFFER_ALIGNMENT, bytes ? bytes : 1) != 0) {
+		return 0;
+	}
+	return p;
+#endif
+}
+
+BUFFERS_API void buffers_heap_free(void* p)
+{
+#if defined(_WIN32)
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+/* node < 0 for the configured policy */
+BUFFERS_API void* buffers_alloc(size_t bytes, int node)
+{
+	bench_buffer_state* state = buffers_state();
+	int backing = BENCH_BACKING_HEAP;
+	size_t mapped = 0;
+	char* p = 0;
+	int policy;
+	buffers_lock(state);
+	buffers_initialize(state);
+	policy = node < 0 ? state->numa_policy : BENCH_NUMA_BIND;
+	if(node < 0) {
+		node = state->numa_node;
+	}
+	if(state->policy != BENCH_PAGES_HEAP && bytes >= state->huge_page) {
+		int slot;
+		for(slot = 0; slot < BENCH_BUFFER_MAPPINGS && state->mappings[slot].address; ++slot) {
+		}
+		if(slot < BENCH_BUFFER_MAPPINGS) {
+			mapped = (bytes + state->huge_page - 1) & ~(state->huge_page - 1);
+			backing = state->policy == BENCH_PAGES_HUGE ? BENCH_BACKING_HUGE
+			        : state->policy == BENCH_PAGES_SMALL ? BENCH_BACKING_SMALL
+			        : BENCH_BACKING_TRANSPARENT;
+			p = buffers_map(state, mapped, &backing, policy, node);
+			if(p) {
+				state->mappings[slot].address = p;
+				state->mappings[slot].mapped = mapped;
+				state->mappings[slot].backing = backing;
+#if defined(__linux__) && defined(BUFFERS_MMAP)
+				if(policy != BENCH_NUMA_DEFAULT) {
+					if(buffers_place(state, p, mapped, policy, node) == 0) {
+						++state->statistics.numa_applied;
+					} else {
+						++state->statistics.numa_failed;
+						state->statistics.numa_error = errno;
+					}
+				}
+#elif defined(BUFFERS_WINDOWS)
+				/* first touch is what Windows does anyway; it has no
+				 * interleaving */
+				if(policy == BENCH_NUMA_INTERLEAVE) {
+					++state->statistics.numa_failed;
+					state->statistics.numa_error = ENOSYS;
+				} else if(policy != BENCH_NUMA_DEFAULT) {
+					++state->statistics.numa_applied;
+				}
+#endif
+			}
+		}
+	}
+	if(!p) {
+		backing = BENCH_BACKING_HEAP;
+		mapped = bytes;
+		p = (char*)buffers_heap_alloc(bytes);
+	}
+	if(p) {
+		++state->statistics.buffers[backing];
+		state->statistics.bytes[backing] += (long long)mapped;
+	}
+	buffers_unlock(state);
+	return p;
+}
+
+BUFFERS_API void* bench_buffer_alloc(size_t bytes)
+{
+	return buffers_alloc(bytes, -1);
+}
+
+/* a buffer bound to NUMA node node, or placed by BENCH_NUMA if node is
+ * negative (bench_numa_current_node() had no answer, say); only mapped
+ * buffers, of a huge page or more, can be bound */
+BUFFERS_API void* bench_buffer_alloc_on_node(size_t bytes, int node)
+{
+	return buffers_alloc(bytes, node);
+}
+
+BUFFERS_API void bench_buffer_free(void* p)
+{
+	bench_buffer_state* state = buffers_state();
+	int slot;
+	if(!p) {
+		return;
+	}
+	buffers_lock(state);
+	for(slot = 0; slot < BENCH_BUFFER_MAPPINGS && state->mappings[slot].address != (char*)p; ++slot) {
+	}
+	if(slot < BENCH_BUFFER_MAPPINGS) {
+		bench_buffer_mapping* mapping = &state->mappings[slot];
+		if(mapping->backing == BENCH_BACKING_TRANSPARENT) {
+			state->statistics.freed_transparent += (long long)mapping->mapped;
+#if defined(__linux__) && defined(BUFFERS_MMAP)
+			state->statistics.freed_transparent_huge += (long long)buffers_huge_bytes(mapping->address, mapping->mapped);
+#endif
+		}
+#if defined(__linux__) && defined(BUFFERS_MMAP)
+		if(state->numa_policy != BENCH_NUMA_DEFAULT || state->memory_node_count > 1) {
+			buffers_record_placement(state, mapping->address, mapping->mapped);
+		}
+#endif
+		buffers_unmap(mapping);
+		mapping->address = 0;
+	} else {
+		buffers_heap_free(p);
+	}
+	buffers_unlock(state);
+}
+
+BUFFERS_API bench_buffer_statistics bench_buffer_stats(void)
+{
+	bench_buffer_state* state = buffers_state();
+	bench_buffer_statistics statistics;
+	buffers_lock(state);
+	statistics = state->statistics;
+	buffers_unlock(state);
+	return statistics;
+}
+
+/* One line about the buffers of one backing, e.g.
+ * "3 x transparent huge pages, 228.0 MiB, 226.0 MiB of it huge when freed";
+ * returns 0, leaving line alone, if there were none. */
+BUFFERS_API int bench_buffer_summary(int backing, char* line, size_t capacity)
+{
+	const bench_buffer_statistics s = bench_buffer_stats();
+	char text[256];
+	int length;
+	if(backing < 0 || backing >= BENCH_BACKING_COUNT || s.buffers[backing] == 0) {
+		return 0;
+	}
+	length = sprintf(text, "%lld x %s, %.1f MiB", s.buffers[backing], bench_backing_name(backing), s.bytes[backing] / 1048576.0);
+	if(backing == BENCH_BACKING_TRANSPARENT && s.freed_transparent > 0) {
+		sprintf(text + length, ", %.1f of %.1f MiB freed were huge", s.freed_transparent_huge / 1048576.0, s.freed_transparent / 1048576.0);
+	} else if(backing == BENCH_BACKING_TRANSPARENT) {
+		sprintf(text + length, ", none freed yet to check");
+	}
+	results_copy(line, capacity, text);
+	return 1;
+}
+
+/* whether any buffer was mapped rather than taken from the heap */
+BUFFERS_API int bench_buffer_mapped(void)
+{
+	const bench_buffer_statistics s = bench_buffer_stats();
+	return s.buffers[BENCH_BACKING_SMALL] + s.buffers[BENCH_BACKING_TRANSPARENT] + s.buffers[BENCH_BACKING_HUGE] > 0;
+}
+
+/* The summary lines, then anything that did not go as asked, then where
+ * the pages were; returns how many lines there are. */
+BUFFERS_API int bench_buffer_lines(char lines[][256], int capacity)
+{
+	const bench_buffer_statistics s = bench_buffer_stats();
+	long long placed = 0;
+	int count = 0;
+	int i;
+	for(i = 0; i < BENCH_BACKING_COUNT && count < capacity; ++i) {
+		count += bench_buffer_summary(i, lines[count], sizeof(lines[count]));
+	}
+	if(s.huge_fallbacks > 0 && count < capacity) {
+		sprintf(lines[count++], "%lld fell back from reserved huge pages (none free?)", s.huge_fallbacks);
+	}
+	if(s.numa_applied > 0 && count < capacity) {
+		if(s.numa_policy == BENCH_NUMA_BIND) {
+			sprintf(lines[count++], "%lld bound to NUMA node %d", s.numa_applied, s.numa_node);
+		} else {
+			sprintf(lines[count++], "%lld placed %s", s.numa_applied, bench_numa_policy_name(s.numa_policy));
+		}
+	}
+	if(s.numa_failed > 0 && count < capacity) {
+		sprintf(lines[count++], "%lld could not be placed %s: %s", s.numa_failed, bench_numa_policy_name(s.numa_policy), strerror(s.numa_error));
+	}
+	for(i = 0; i < BENCH_NUMA_MAX_NODES; ++i) {
+		placed += s.node_bytes[i];
+	}
+	for(i = 0; i < BENCH_NUMA_MAX_NODES && count < capacity; ++i) {
+		if(s.node_bytes[i] > 0) {
+			sprintf(lines[count++], "node %d had %.1f MiB of the pages freed (%.1f%%)", i, s.node_bytes[i] / 1048576.0, 100.0 * s.node_bytes[i] / (placed + s.unplaced_bytes));
+		}
+	}
+	return count;
+}
+
+/* prints bench_buffer_lines(), each line starting with prefix */
+BUFFERS_API void bench_buffer_report(FILE* out, const char* prefix)
+{
+	char lines[BENCH_BUFFER_LINES][256];
+	const int count = bench_buffer_lines(lines, BENCH_BUFFER_LINES);
+	int i;
+	for(i = 0; i < count; ++i) {
+		fprintf(out, "%s%s\n", prefix, lines[i]);
+	}
+}
+
+/* bytes of each backing, and how much of the transparent ones was huge */
+BUFFERS_API void bench_result_buffers(bench_result* r)
+{
+	static const char* const names[] = { "buffer_heap_bytes", "buffer_small_bytes", "buffer_transparent_bytes", "buffer_huge_bytes" };
+	const bench_buffer_statistics s = bench_buffer_stats();
+	int backing;
+	for(backing = 0; backing < BENCH_BACKING_COUNT; ++backing) {
+		if(s.buffers[backing] > 0) {
+			bench_result_metric(r, names[backing], (double)s.bytes[backing], "bytes");
+		}
+	}
+	if(s.freed_transparent > 0) {
+		bench_result_metric(r, "transparent_huge_fraction", (double)s.freed_transparent_huge / (double)s.freed_transparent, "");
+	}
+	for(backing = 0; backing < BENCH_NUMA_MAX_NODES; ++backing) {
+		if(s.node_bytes[backing] > 0) {
+			char name[40];
+			sprintf(name, "node%d_bytes", backing);
+			bench_result_metric(r, name, (double)s.node_bytes[backing], "bytes");
+		}
+	}
+}
+
+/* the NUMA node of the page at address, -1 if it has none yet or there is
+ * no telling */
+BUFFERS_API int bench_numa_node_of(const void* address)
+{
+#if defined(__linux__) && defined(BUFFERS_MMAP)
+	void* page = (void*)((size_t)address & ~((size_t)sysconf(_SC_PAGESIZE) - 1));
+	int status = -1;
+	if(syscall(SYS_move_pages, 0, 1ul, &page, 0, &status, 0) != 0 || status < 0) {
+		return -1;
+	}
+	return status;
+#else
+	(void)address;
+	return -1;
+#endif
+}
+
+/* the NUMA node of the CPU the calling thread is on, -1 if there is no
+ * telling */
+BUFFERS_API int bench_numa_current_node(void)
+{
+#if defined(__linux__) && defined(BUFFERS_MMAP)
+	unsigned int cpu = 0, node = 0;
+	if(syscall(SYS_getcpu, &cpu, &node, 0) != 0) {
+		return -1;
+	}
+	return (int)node;
+#elif defined(BUFFERS_WINDOWS)
+	PROCESSOR_NUMBER processor;
+	USHORT node = 0;
+	GetCurrentProcessorNumberEx(&processor);
+	if(!GetNumaProcessorNodeEx(&processor, &node)) {
+		return -1;
+	}
+	return (int)node;
+#else
+	return -1;
+#endif
+}
+
+BUFFERS_API int bench_numa_policy(void)
+{
+	bench_buffer_state* state = buffers_state();
+	int policy;
+	buffers_lock(state);
+	buffers_initialize(state);
+	policy = state->numa_policy;
+	buffers_unlock(state);
+	return policy;
+}
+
+/* how many NUMA nodes have memory */
+BUFFERS_API int bench_numa_node_count(void)
+{
+	bench_buffer_state* state = buffers_state();
+	int count;
+	buffers_lock(state);
+	buffers_initialize(state);
+	count = state->memory_node_count;
+	buffers_unlock(state);
+	return count;
+}
+
+/* Where the pages of count arrays of elements elements each are, and how
+ * many of them are on the node of the thread that looks at them; pages and
+ * local get one count per node. One element per page is looked at, in an
+ * OpenMP loop over the elements with the default schedule, so each page is
+ * looked at by the thread that a plain "omp parallel for" over the arrays
+ * gives it to. Returns how many pages had a node that could be read. */
+BUFFERS_API long long bench_numa_placement(void* const* arrays, int count, size_t elements, size_t element_size, long long* pages, long long* local)
+{
+#if defined(__linux__) && defined(BUFFERS_MMAP)
+	const ptrdiff_t per_page = (ptrdiff_t)((size_t)sysconf(_SC_PAGESIZE) / element_size);
+	const ptrdiff_t length = (ptrdiff_t)elements;
+	long long total = 0;
+	ptrdiff_t j;
+	int k;
+	memset(pages, 0, BENCH_NUMA_MAX_NODES * sizeof(*pages));
+	memset(local, 0, BENCH_NUMA_MAX_NODES * sizeof(*local));
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for(j = 0; j < length; ++j) {
+		if(per_page == 0 || j % per_page == 0) {
+			const int here = bench_numa_current_node();
+			int n;
+			for(n = 0; n < count; ++n) {
+				const int node = bench_numa_node_of((const char*)arrays[n] + (size_t)j * element_size);
+				if(node < 0 || node >= BENCH_NUMA_MAX_NODES) {
+					continue;
+				}
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+				pages[node]++;
+				if(node == here) {
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+					local[node]++;
+				}
+			}
+		}
+	}
+	for(k = 0; k < BENCH_NUMA_MAX_NODES; ++k) {
+		total += pages[k];
+	}
+	return total;
+#else
+	(void)arrays;
+	(void)count;
+	(void)elements;
+	(void)element_size;
+	memset(pages, 0, BENCH_NUMA_MAX_NODES * sizeof(*pages));
+	memset(local, 0, BENCH_NUMA_MAX_NODES * sizeof(*local));
+	return 0;
+#endif
+}
+
+#if defined(__cplusplus)
+#include <cstddef>
+#include <new>
+
+// An STL allocator handing out bench_buffer_alloc() memory:
+//
+//   std::vector<double, buffer_allocator<double> > u(n);
+template<typename T>
+struct buffer_allocator {
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	template<typename U>
+	struct rebind {
+		typedef buffer_allocator<U> other;
+	};
+
+	buffer_allocator() {
+	}
+
+	template<typename U>
+	buffer_allocator(const buffer_allocator<U>&) {
+	}
+
+	pointer address(reference r) const {
+		return &r;
+	}
+
+	const_pointer address(const_reference r) const {
+		return &r;
+	}
+
+	pointer allocate(size_type n, const void* = 0) {
+		if(n > max_size()) {
+			throw std::bad_alloc();
+		}
+		void* p = bench_buffer_alloc(n * sizeof(T));
+		if(!p) {
+			throw std::bad_alloc();
+		}
+		return static_cast<pointer>(p);
+	}
+
+	void deallocate(pointer p, size_type) {
+		bench_buffer_free(p);
+	}
+
+	size_type max_size() const {
+		return static_cast<size_type>(-1) / sizeof(T);
+	}
+
+	void construct(pointer p, const T& value) {
+		new(static_cast<void*>(p)) T(value);
+	}
+
+	void destroy(pointer p) {
+		p->~T();
+	}
+};
+
+template<typename T, typename U>
+inline bool operator==(const buffer_allocator<T>&, const buffer_allocator<U>&) {
+	return true;
+}
+
+template<typename T, typename U>
+inline bool operator!=(const buffer_allocator<T>&, const buffer_allocator<U>&) {
+	return false;
+}
+
+// The same, except that std::vector<T, untouched_allocator<T> > v(n) leaves
+// elements of built-in type uninitialized instead of zeroing them from the
+// calling thread. The threads that fill the buffer then touch its pages
+// first, and under first-touch placement get them on their own nodes.
+template<typename T>
+struct untouched_allocator : buffer_allocator<T> {
+	template<typename U>
+	struct rebind {
+		typedef untouched_allocator<U> other;
+	};
+
+	untouched_allocator() {
+	}
+
+	template<typename U>
+	untouched_allocator(const untouched_allocator<U>&) {
+	}
+
+	using buffer_allocator<T>::construct;
+
+	template<typename U>
+	void construct(U* p) {
+		new(static_cast<void*>(p)) U;
+	}
+};
+#endif
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef CPU_FEATURES_HPP
+#define CPU_FEATURES_HPP
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Runtime instruction-set dispatch, so that one binary uses AVX2 or AVX-512
+// where the CPU has them and still runs where it does not.
+//
+// A kernel writes one implementation per level it cares about, each
+// function marked with the matching ISA_TARGET_* so that the compiler
+// accepts that level's intrinsics in it (and only in it), and picks one at
+// startup:
+//
+//   flips_fn count_flips = select_isa<flips_fn>("flips", count_flips_scalar,
+//                          count_flips_sse, count_flips_avx2, count_flips_avx512);
+//
+// A level without an implementation may be passed as 0; the best level at
+// or below what the CPU supports wins. The CPU is asked once, with cpuid,
+// and the operating system's saved register state (xgetbv) is checked too,
+// since AVX registers are no use if the kernel does not preserve them.
+//
+//   BENCH_ISA  scalar, sse, avx2 or avx512: use nothing above this level,
+//              to compare the implementations on one machine  (best there is)
+//
+// The levels are
+//
+//   scalar  plain C++
+//   sse     SSE2 and SSSE3
+//   avx2    AVX2 and FMA
+//   avx512  AVX-512 F, BW, DQ and VL (Skylake-SP and later)
+//
+// Programs that dispatch are built for the baseline instruction set rather
+// than -march=native; see the Makefile.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_FEATURES_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(__GNUC__) && defined(CPU_FEATURES_X86)
+#define ISA_TARGET(features) __attribute__((target(features)))
+// inlines everything a dispatched entry point calls, so that helpers written
+// once for every level are compiled for the level of the function they are
+// called from
+#define ISA_FLATTEN __attribute__((flatten))
+#else
+// MSVC accepts every intrinsic anywhere
+#define ISA_TARGET(features)
+#define ISA_FLATTEN
+#endif
+
+#define ISA_TARGET_SSE    ISA_TARGET("sse2,ssse3")
+#define ISA_TARGET_AVX2   ISA_TARGET("sse2,ssse3,sse4.1,avx,avx2,fma")
+#define ISA_TARGET_AVX512 ISA_TARGET("sse2,ssse3,sse4.1,avx,avx2,fma,avx512f,avx512bw,avx512dq,avx512vl")
+
+enum isa_level {
+	isa_scalar,
+	isa_sse,
+	isa_avx2,
+	isa_avx512,
+	isa_level_count
+};
+
+struct cpu_features {
+	bool sse2;
+	bool ssse3;
+	bool sse41;
+	bool avx;
+	bool fma;
+	bool avx2;
+	bool avx512f;
+	bool avx512bw;
+	bool avx512dq;
+	bool avx512vl;
+};
+
+inline const char* isa_name(isa_level level) {
+	static const char* const names[] = { "scalar", "sse", "avx2", "avx512" };
+	return level >= 0 && level < isa_level_count ? names[level] : "unknown";
+}
+
+namespace cpu_features_detail {
+#ifdef CPU_FEATURES_X86
+	inline void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int (&registers)[4]) {
+#ifdef _MSC_VER
+		int r[4];
+		__cpuidex(r, static_cast<int>(leaf), static_cast<int>(subleaf));
+		for(int i = 0; i < 4; ++i) {
+			registers[i] = static_cast<unsigned int>(r[i]);
+		}
+#else
+		__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+	}
+
+	// the register state the operating system saves and restores
+	inline unsigned long long xgetbv() {
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		unsigned int low, high;
+		__asm__ __volatile__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+		return (static_cast<unsigned long long>(high) << 32) | low;
+#endif
+	}
+#endif
+
+	inline cpu_features detect() {
+		cpu_features f;
+		std::memset(&f, 0, sizeof(f));
+#ifdef CPU_FEATURES_X86
+		unsigned int r[4] = { 0, 0, 0, 0 };
+		cpuid(0, 0, r);
+		const unsigned int max_leaf = r[0];
+		if(max_leaf < 1) {
+			return f;
+		}
+		cpuid(1, 0, r);
+		f.sse2  = (r[3] & (1u << 26)) != 0;
+		f.ssse3 = (r[2] & (1u << 9)) != 0;
+		f.sse41 = (r[2] & (1u << 19)) != 0;
+		const bool osxsave = (r[2] & (1u << 27)) != 0;
+		const unsigned long long state = osxsave ? xgetbv() : 0;
+		const bool ymm = (state & 0x6) == 0x6;    // XMM and YMM
+		const bool zmm = (state & 0xe6) == 0xe6;  // and opmask, ZMM0-15 upper halves, ZMM16-31
+		f.avx = ymm && (r[2] & (1u << 28)) != 0;
+		f.fma = f.avx && (r[2] & (1u << 12)) != 0;
+		if(max_leaf >= 7) {
+			cpuid(7, 0, r);
+			f.avx2     = f.avx && (r[1] & (1u << 5)) != 0;
+			f.avx512f  = zmm && (r[1] & (1u << 16)) != 0;
+			f.avx512dq = f.avx512f && (r[1] & (1u << 17)) != 0;
+			f.avx512bw = f.avx512f && (r[1] & (1u << 30)) != 0;
+			f.avx512vl = f.avx512f && (r[1] & (1u << 31)) != 0;
+		}
+#endif
+		return f;
+	}
+
+	// what was chosen for each dispatched function, for the runner's report
+	inline std::vector<std::pair<std::string, isa_level> >& choices() {
+		static std::vector<std::pair<std::string, isa_level> > chosen;
+		return chosen;
+	}
+}
+
+inline const cpu_features& detected_cpu_features() {
+	static const cpu_features features = cpu_features_detail::detect();
+	return features;
+}
+
+// the highest level this CPU (and operating system) supports, no higher
+// than BENCH_ISA
+inline isa_level best_isa() {
+	const cpu_features& f = detected_cpu_features();
+	isa_level level = isa_scalar;
+	if(f.sse2 && f.ssse3) {
+		level = isa_sse;
+		if(f.sse41 && f.avx2 && f.fma) {
+			level = isa_avx2;
+			if(f.avx512f && f.avx512bw && f.avx512dq && f.avx512vl) {
+				level = isa_avx512;
+			}
+		}
+	}
+	if(const char* cap = std::getenv("BENCH_ISA")) {
+		for(int l = 0; l < isa_level_count; ++l) {
+			if(std::strcmp(cap, isa_name(static_cast<isa_level>(l))) == 0 && l < level) {
+				level = static_cast<isa_level>(l);
+			}
+		}
+	}
+	return level;
+}
+
+// The best of the implementations given for the levels this machine has.
+// scalar must not be 0.
+template<typename F>
+F select_isa(const char* name, F scalar, F sse, F avx2, F avx512) {
+	const F implementations[isa_level_count] = { scalar, sse, avx2, avx512 };
+	int level = best_isa();
+	while(level > isa_scalar && !implementations[level]) {
+		--level;
+	}
+	cpu_features_detail::choices().push_back(std::make_pair(std::string(name), static_cast<isa_level>(level)));
+	return implementations[level];
+}
+
+// every select_isa() so far, as "name level" pairs
+inline const std::vector<std::pair<std::string, isa_level> >& isa_choices() {
+	return cpu_features_detail::choices();
+}
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef MACHINE_HPP
+#define MACHINE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// timer.hpp brings in <Windows.h>, with NOMINMAX
+#include "timer.hpp"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#elif defined(__linux__) && !defined(EMSCRIPTEN)
+#define MACHINE_LINUX
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// What the machine was doing while a kernel ran, and how to keep it quiet.
+//
+// pin_to_cpus() restricts the process to a list of CPUs, and (when the
+// kernel is built with OpenMP) gives each OpenMP thread a CPU of its own
+// from that list. inspect_machine() reads the frequency governor, turbo and
+// SMT state from sysfs, and notes whether any two of the pinned CPUs are
+// SMT siblings, which would make them compete for one core.
+//
+// frequency_probe() times a short, fixed chain of dependent integer
+// multiply-adds. Its time per iteration follows the core clock, so probes
+// taken between samples that disagree mean the clock moved during the run
+// (turbo, thermal throttling, a governor ramping up), or that something else
+// kept taking the CPU away; either way the samples are not comparable.
+
+struct machine_state {
+	std::string governor;   // empty if unknown
+	int turbo;              // 1 on, 0 off, -1 unknown
+	int smt;                // 1 active, 0 not, -1 unknown
+	std::vector<int> cpus;  // what the process was pinned to, if anything
+	bool pinned_siblings;   // two of those CPUs share a core
+
+	machine_state() : turbo(-1), smt(-1), pinned_siblings(false) {
+	}
+};
+
+namespace machine_detail {
+	inline std::string read_line(const std::string& path) {
+		std::ifstream in(path.c_str());
+		std::string line;
+		std::getline(in, line);
+		return line;
+	}
+
+	inline std::string cpu_path(int cpu, const char* leaf) {
+		std::ostringstream os;
+		os << "/sys/devices/system/cpu/cpu" << cpu << "/" << leaf;
+		return os.str();
+	}
+}
+
+// "0-3,8,10-11" -> 0 1 2 3 8 10 11, the format of both BENCH_CPUS and sysfs
+inline std::vector<int> parse_cpu_list(const std::string& list) {
+	std::vector<int> cpus;
+	std::istringstream in(list);
+	std::string range;
+	while(std::getline(in, range, ',')) {
+		if(range.empty()) {
+			continue;
+		}
+		const std::string::size_type dash = range.find('-');
+		const int first = std::atoi(range.c_str());
+		const int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+		for(int cpu = first; cpu <= last; ++cpu) {
+			cpus.push_back(cpu);
+		}
+	}
+	return cpus;
+}
+
+// Returns false (with a reason) if the affinity could not be set.
+inline bool pin_to_cpus(const std::vector<int>& cpus, std::string& error) {
+	if(cpus.empty()) {
+		error = "no CPUs given";
+		return false;
+	}
+#if defined(MACHINE_LINUX)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(size_t i = 0; i < cpus.size(); ++i) {
+		CPU_SET(cpus[i], &set);
+	}
+	if(::sched_setaffinity(0, sizeof(set), &set) != 0) {
+		error = "sched_setaffinity failed";
+		return false;
+	}
+#ifdef _OPENMP
+	// the pool's threads are created by the first parallel region and then
+	// reused, so pinning them once here sticks
+	#pragma omp parallel
+	{
+		cpu_set_t own;
+		CPU_ZERO(&own);
+		CPU_SET(cpus[omp_get_thread_num() % cpus.size()], &own);
+		::sched_setaffinity(0, sizeof(own), &own);
+	}
+#endif
+	return true;
+#elif defined(_WIN32)
+	DWORD_PTR mask = 0;
+	for(size_t i = 0; i < cpus.size(); ++i) {
+		if(cpus[i] < static_cast<int>(8 * sizeof(DWORD_PTR))) {
+			mask |= static_cast<DWORD_PTR>(1) << cpus[i];
+		}
+	}
+	if(!::SetProcessAffinityMask(::GetCurrentProcess(), mask)) {
+		error = "SetProcessAffinityMask failed";
+		return false;
+	}
+#ifdef _OPENMP
+	#pragma omp parallel
+	{
+		::SetThreadAffinityMask(::GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpus[omp_get_thread_num() % cpus.size()]);
+	}
+#endif
+	return true;
+#else
+	error = "CPU affinity is not supported on this platform";
+	return false;
+#endif
+}
+
+inline machine_state inspect_machine(const std::vector<int>& pinned) {
+	machine_state state;
+	state.cpus = pinned;
+#if defined(MACHINE_LINUX)
+	using machine_detail::read_line;
+	std::vector<int> cpus = pinned;
+	if(cpus.empty()) {
+		cpus = parse_cpu_list(read_line("/sys/devices/system/cpu/online"));
+	}
+	for(size_t i = 0; i < cpus.size(); ++i) {
+		const std::string governor = read_line(machine_detail::cpu_path(cpus[i], "cpufreq/scaling_governor"));
+		if(!governor.empty() && state.governor.find(governor) == std::string::npos) {
+			state.governor += (state.governor.empty() ? "" : "/") + governor;
+		}
+	}
+	const std::string no_turbo = read_line("/sys/devices/system/cpu/intel_pstate/no_turbo");
+	const std::string boost = read_line("/sys/devices/system/cpu/cpufreq/boost");
+	if(!no_turbo.empty()) {
+		state.turbo = no_turbo == "0" ? 1 : 0;
+	} else if(!boost.empty()) {
+		state.turbo = boost == "1" ? 1 : 0;
+	}
+	const std::string smt = read_line("/sys/devices/system/cpu/smt/active");
+	if(!smt.empty()) {
+		state.smt = smt == "1" ? 1 : 0;
+	}
+	for(size_t i = 0; i < pinned.size() && !state.pinned_siblings; ++i) {
+		const std::vector<int> siblings = parse_cpu_list(read_line(machine_detail::cpu_path(pinned[i], "topology/thread_siblings_list")));
+		for(size_t j = 0; j < siblings.size(); ++j) {
+			if(siblings[j] != pinned[i] && std::find(pinned.begin(), pinned.end(), siblings[j]) != pinned.end()) {
+				state.pinned_siblings = true;
+			}
+		}
+	}
+#endif
+	return state;
+}
+
+inline void report_machine(const machine_state& state, std::ostream& os) {
+	os << "machine: governor " << (state.governor.empty() ? "unknown" : state.governor);
+	if(!state.governor.empty() && state.governor != "performance") {
+		os << " (not performance)";
+	}
+	os << ", turbo " << (state.turbo == 1 ? "on" : state.turbo == 0 ? "off" : "unknown")
+	   << ", smt " << (state.smt == 1 ? "on" : state.smt == 0 ? "off" : "unknown");
+	if(!state.cpus.empty()) {
+		os << ", pinned to";
+		for(size_t i = 0; i < state.cpus.size(); ++i) {
+			os << (i ? "," : " ") << state.cpus[i];
+		}
+		if(state.pinned_siblings) {
+			os << " (includes SMT siblings)";
+		}
+	}
+	os << std::endl;
+}
+
+// Nanoseconds per iteration of a dependent multiply-add chain: the best of
+// a few short runs, so that one interruption does not count as a slow clock.
+// The chain is integer so that whatever floating-point or vector state the
+// kernel left behind cannot change its speed.
+inline double frequency_probe() {
+	const unsigned iterations = 1u << 18;
+	double best = 0.0;
+	for(int attempt = 0; attempt < 5; ++attempt) {
+		volatile unsigned long long seed = 1;
+		unsigned long long x = seed;
+		high_resolution_timer timer;
+		for(unsigned i = 0; i < iterations; ++i) {
+			x = x * 6364136223846793005ull + 1442695040888963407ull;
+		}
+		const double elapsed = std::chrono::duration_cast<std::chrono::duration<double, std::nano> >(timer.pulse()).count();
+		seed = x;
+		const double per_iteration = elapsed / iterations;
+		if(attempt == 0 || per_iteration < best) {
+			best = per_iteration;
+		}
+	}
+	return best;
+}
+
+// Spread of a set of probes, as a percentage of the fastest.
+inline double frequency_drift(const std::vector<double>& probes) {
+	if(probes.size() < 2) {
+		return 0.0;
+	}
+	const double fastest = *std::min_element(probes.begin(), probes.end());
+	const double slowest = *std::max_element(probes.begin(), probes.end());
+	return fastest > 0.0 ? 100.0 * (slowest - fastest) / fastest : 0.0;
+}
+
+// Times this process was preempted so far, or -1 where that is not known.
+inline long long involuntary_switches() {
+#if defined(MACHINE_LINUX)
+	struct rusage usage;
+	if(::getrusage(RUSAGE_SELF, &usage) == 0) {
+		return usage.ru_nivcsw;
+	}
+#endif
+	return -1;
+}
+
+#endif
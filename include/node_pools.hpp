@@ -0,0 +1,918 @@
+#ifndef NODE_POOLS_HPP
+#define NODE_POOLS_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/pool/pool.hpp>
+#include <boost/pool/object_pool.hpp>
+
+#include "allocations.hpp"
+#include "buffers.h"
+
+// Allocation policies for kernels that build a great many small objects of
+// one type, binary-trees' nodes above all, so that one kernel can be timed
+// with each of them. A policy is a store, made for a batch of objects:
+//
+//   Store store;
+//   T* p = store.construct(arguments...);
+//   store.destroy(p);  // only for stores with frees_objects; the others
+//                      // give everything back at once when they go
+//
+// Store::reserve(n) says that this thread is about to have n objects live
+// at once; stores that can make room for them up front do.
+//
+// The stores are
+//
+//   new            operator new and delete for every object
+//   object_pool    boost::object_pool: free lists in chunks that double, and
+//                  on destruction a scan for objects still live to destruct
+//   pool           boost::pool: the same chunks, no destructor tracking
+//   arena          a bump pointer through chunks that double; nothing is
+//                  freed until the store goes, and reset() rewinds it in O(1)
+//   thread-arena   a bump pointer through a region each thread keeps for
+//                  good and uses as a stack: a store starts at the top of
+//                  its thread's region and rewinds it, in O(1), when it goes
+//   numa-arena     thread-arena with the region's blocks bound to the NUMA
+//                  node the thread was on when it needed them; for threads
+//                  that stay put (OMP_PROC_BIND)
+//   slab           fixed-size blocks cached per thread and refilled in
+//                  batches from a depot of slabs shared by every thread, like
+//                  the front end of tcmalloc; slabs are never given back
+//   pmr-monotonic  std::pmr-style: a monotonic_buffer_resource over
+//                  new_delete_resource, every allocation a virtual call
+//   pmr-pool       the same with an unsynchronized_pool_resource, which
+//                  takes single objects back into per-size free lists
+//
+// Objects in arena, thread-arena, pool and pmr-monotonic stores are never
+// destructed, so they are for types with trivial destructors. A thread-arena
+// (or numa-arena) store builds in the region of the thread that made it, so only that
+// thread may use it; it has to go before any store made on that thread
+// after it, and while the thread is not building in another.
+//
+// Every store counts the memory it takes from the system (the heap's own
+// sizes for new, chunks and slabs for the rest); pool_bytes() is what all
+// stores of all threads hold now and peak_pool_bytes() its high-water mark.
+//
+// The thread-arena and numa-arena regions outlive their stores, so that the
+// next store on the thread finds the room already there; once no store of
+// them is open on a thread, release_thread_regions<T>() gives that thread's
+// back.
+//
+// with_node_pool<T>(name, visitor) calls visitor.visit<Store>() with the
+// store of that name for objects of type T, to choose one at run time;
+// node_pool_names() lists the names.
+
+#if defined(_MSC_VER)
+#define NODE_POOLS_THREAD_LOCAL __declspec(thread)
+#else
+#define NODE_POOLS_THREAD_LOCAL __thread
+#endif
+
+namespace node_pools_detail {
+	struct shared_bytes {
+		volatile long long live;
+		volatile long long peak;
+	};
+
+	inline shared_bytes& shared() {
+		static shared_bytes bytes;
+		return bytes;
+	}
+
+	inline void taken(long long bytes) {
+		shared_bytes& all = shared();
+		const long long live = allocations_detail::atomic_add(all.live, bytes);
+		long long peak = all.peak;
+		while(live > peak && !allocations_detail::compare_exchange(all.peak, peak, live)) {
+			peak = all.peak;
+		}
+	}
+
+	inline void given_back(long long bytes) {
+		allocations_detail::atomic_add(shared().live, -bytes);
+	}
+
+	// Stores that allocate object by object count into one of these and
+	// pass it on in batches, so that threads do not fight over the total.
+	class meter {
+	public:
+		meter() : pending(0) {
+		}
+
+		~meter() {
+			flush();
+		}
+
+		void add(long long bytes) {
+			pending += bytes;
+			if(pending >= batch || pending <= -batch) {
+				flush();
+			}
+		}
+
+		void flush() {
+			if(pending > 0) {
+				taken(pending);
+			} else if(pending < 0) {
+				given_back(-pending);
+			}
+			pending = 0;
+		}
+
+	private:
+		enum { batch = 64 * 1024 };
+		long long pending;
+
+		meter(const meter&);
+		meter& operator=(const meter&);
+	};
+
+	// what the heap really spends on a block it handed out
+	inline long long heap_size(void* p, size_t requested) {
+#if defined(__GLIBC__)
+		(void)requested;
+		return static_cast<long long>(malloc_usable_size(p) + sizeof(size_t));
+#elif defined(_WIN32)
+		return static_cast<long long>(_msize(p));
+#else
+		(void)p;
+		return static_cast<long long>(requested);
+#endif
+	}
+
+	// Memory for chunks and slabs, counted, with its size kept in front so
+	// that it can be freed without being told the size.
+	enum { header = 16 };
+
+	inline void* system_allocate(size_t bytes) {
+		char* block = static_cast<char*>(std::malloc(bytes + header));
+		if(!block) {
+			return 0;
+		}
+		*reinterpret_cast<size_t*>(block) = bytes;
+		taken(static_cast<long long>(bytes));
+		return block + header;
+	}
+
+	inline void system_free(void* p) {
+		if(!p) {
+			return;
+		}
+		char* block = static_cast<char*>(p) - header;
+		given_back(static_cast<long long>(*reinterpret_cast<size_t*>(block)));
+		std::free(block);
+	}
+
+	// the UserAllocator of the boost pools
+	struct counted_user_allocator {
+		typedef std::size_t size_type;
+		typedef std::ptrdiff_t difference_type;
+
+		static char* malloc(const size_type bytes) {
+			return static_cast<char*>(system_allocate(bytes));
+		}
+
+		static void free(char* const block) {
+			system_free(block);
+		}
+	};
+
+	// singly linked blocks, the link kept in the block itself
+	inline void*& next_of(void* block) {
+		return *static_cast<void**>(block);
+	}
+
+	// The slabs of one block size, shared by every thread, handed out a
+	// batch (a linked list of blocks) at a time.
+	template<size_t Size>
+	class slab_depot {
+	public:
+		enum { block = Size < sizeof(void*) ? sizeof(void*) : (Size + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*) };
+		enum { slab_bytes = 64 * 1024 };
+		enum { batch = slab_bytes / block };
+
+		static slab_depot& instance() {
+			static slab_depot depot;
+			return depot;
+		}
+
+		// a batch of blocks; count is how many
+		void* take(size_t& count) {
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if(!batches.empty()) {
+					void* head = batches.back().first;
+					count = batches.back().second;
+					batches.pop_back();
+					return head;
+				}
+			}
+			char* slab = static_cast<char*>(system_allocate(slab_bytes));
+			if(!slab) {
+				throw std::bad_alloc();
+			}
+			for(size_t i = 0; i + 1 < batch; ++i) {
+				next_of(slab + i * block) = slab + (i + 1) * block;
+			}
+			next_of(slab + (batch - 1) * block) = 0;
+			count = batch;
+			return slab;
+		}
+
+		void give(void* head, size_t count) {
+			std::lock_guard<std::mutex> guard(lock);
+			batches.push_back(std::make_pair(head, count));
+		}
+
+	private:
+		std::mutex lock;
+		std::vector<std::pair<void*, size_t> > batches;
+
+		slab_depot() {
+		}
+		slab_depot(const slab_depot&);
+		slab_depot& operator=(const slab_depot&);
+	};
+
+	// plain data, so that it can be thread-local without a constructor
+	struct slab_cache {
+		void* head;
+		size_t count;
+	};
+
+	template<size_t Size>
+	inline slab_cache& this_thread_cache() {
+		static NODE_POOLS_THREAD_LOCAL slab_cache cache;
+		return cache;
+	}
+
+	template<size_t Size>
+	inline void* slab_allocate() {
+		slab_cache& cache = this_thread_cache<Size>();
+		if(!cache.head) {
+			cache.head = slab_depot<Size>::instance().take(cache.count);
+		}
+		void* p = cache.head;
+		cache.head = next_of(p);
+		--cache.count;
+		return p;
+	}
+
+	template<size_t Size>
+	inline void slab_free(void* p) {
+		typedef slab_depot<Size> depot;
+		slab_cache& cache = this_thread_cache<Size>();
+		next_of(p) = cache.head;
+		cache.head = p;
+		// keep up to two batches; pass one back beyond that, so that blocks
+		// freed by one thread can be used by another
+		if(++cache.count >= 2 * depot::batch) {
+			void* tail = cache.head;
+			for(size_t i = 1; i < depot::batch; ++i) {
+				tail = next_of(tail);
+			}
+			void* spilled = cache.head;
+			cache.head = next_of(tail);
+			next_of(tail) = 0;
+			cache.count -= depot::batch;
+			depot::instance().give(spilled, depot::batch);
+		}
+	}
+
+	struct region_block {
+		region_block* following;
+		size_t bytes;
+		char padding[16 - (sizeof(void*) + sizeof(size_t)) % 16];
+
+		char* begin() {
+			return reinterpret_cast<char*>(this + 1);
+		}
+
+		char* end() {
+			return begin() + bytes;
+		}
+	};
+
+	// One thread's region for the thread-arena stores of one object size:
+	// blocks kept for the life of the program and filled from the bottom up.
+	// Plain data, like slab_cache.
+	struct thread_region {
+		region_block* first;
+		region_block* current;
+		char* next;
+		char* limit;
+		int stores; // open on it
+	};
+
+	template<size_t Size, bool Local>
+	inline thread_region& this_thread_region() {
+		static NODE_POOLS_THREAD_LOCAL thread_region region;
+		return region;
+	}
+
+	// Blocks of a local region are mapped, a huge page at least, so that
+	// they can be bound.
+	enum { local_block = 2 * 1024 * 1024 };
+
+	inline region_block* new_region_block(size_t bytes, bool local) {
+		if(!local) {
+			return static_cast<region_block*>(system_allocate(sizeof(region_block) + bytes));
+		}
+		void* p = bench_buffer_alloc_on_node(sizeof(region_block) + bytes, bench_numa_current_node());
+		if(p) {
+			taken(static_cast<long long>(sizeof(region_block) + bytes));
+		}
+		return static_cast<region_block*>(p);
+	}
+
+	inline void free_region_block(region_block* b, bool local) {
+		if(!local) {
+			system_free(b);
+			return;
+		}
+		given_back(static_cast<long long>(sizeof(region_block) + b->bytes));
+		bench_buffer_free(b);
+	}
+
+	// gives every block of the calling thread's region back, unless a store
+	// is still open on it
+	template<size_t Size, bool Local>
+	inline void release_region() {
+		thread_region& region = this_thread_region<Size, Local>();
+		if(region.stores) {
+			return;
+		}
+		while(region.first) {
+			region_block* b = region.first;
+			region.first = b->following;
+			free_region_block(b, Local);
+		}
+		region.current = 0;
+		region.next = region.limit = 0;
+	}
+
+	// Makes room for bytes more at the top of the region: in the block in
+	// use, else in the one after it if that is big enough, else in a new one
+	// put in between. A local region's blocks go on the thread's NUMA node.
+	inline void make_room(thread_region& region, size_t bytes, bool local) {
+		if(static_cast<size_t>(region.limit - region.next) >= bytes) {
+			return;
+		}
+		region_block* following = region.current ? region.current->following : region.first;
+		if(!following || following->bytes < bytes) {
+			size_t size = region.current ? 2 * region.current->bytes : local ? local_block - sizeof(region_block) : 64 * 1024;
+			if(size < bytes) {
+				size = bytes;
+			}
+			region_block* b = new_region_block(size, local);
+			if(!b) {
+				throw std::bad_alloc();
+			}
+			b->following = following;
+			b->bytes = size;
+			if(region.current) {
+				region.current->following = b;
+			} else {
+				region.first = b;
+			}
+			following = b;
+		}
+		region.current = following;
+		region.next = following->begin();
+		region.limit = following->end();
+	}
+}
+
+// std::pmr's memory resources, which C++11 does not have yet, done the same
+// way: allocation through a virtual call on an abstract resource.
+namespace pmr_style {
+	enum { max_alignment = 16 };
+
+	class memory_resource {
+	public:
+		virtual ~memory_resource() {
+		}
+
+		void* allocate(size_t bytes, size_t alignment = max_alignment) {
+			return do_allocate(bytes, alignment);
+		}
+
+		void deallocate(void* p, size_t bytes, size_t alignment = max_alignment) {
+			do_deallocate(p, bytes, alignment);
+		}
+
+	private:
+		virtual void* do_allocate(size_t bytes, size_t alignment) = 0;
+		virtual void do_deallocate(void* p, size_t bytes, size_t alignment) = 0;
+	};
+
+	class counted_new_delete_resource : public memory_resource {
+	private:
+		virtual void* do_allocate(size_t bytes, size_t) {
+			void* p = node_pools_detail::system_allocate(bytes);
+			if(!p) {
+				throw std::bad_alloc();
+			}
+			return p;
+		}
+
+		virtual void do_deallocate(void* p, size_t, size_t) {
+			node_pools_detail::system_free(p);
+		}
+	};
+
+	// counted, so that what the pmr stores take is seen like the others'
+	inline memory_resource* new_delete_resource() {
+		static counted_new_delete_resource resource;
+		return &resource;
+	}
+
+	// Hands out memory from chunks that double, never reuses any, and gives
+	// it all back at once.
+	class monotonic_buffer_resource : public memory_resource {
+	public:
+		explicit monotonic_buffer_resource(memory_resource* upstream_ = new_delete_resource()) : upstream(upstream_), chunks(0), next(0), limit(0), next_size(4096) {
+		}
+
+		~monotonic_buffer_resource() {
+			release();
+		}
+
+		void release() {
+			while(chunks) {
+				chunk* c = chunks;
+				chunks = c->previous;
+				upstream->deallocate(c, c->size);
+			}
+			next = limit = 0;
+		}
+
+	private:
+		struct chunk {
+			chunk* previous;
+			size_t size;
+		};
+
+		memory_resource* upstream;
+		chunk* chunks;
+		char* next;
+		char* limit;
+		size_t next_size;
+
+		virtual void* do_allocate(size_t bytes, size_t alignment) {
+			char* p = align(next, alignment);
+			if(!next || p + bytes > limit) {
+				while(next_size < bytes + sizeof(chunk) + alignment) {
+					next_size *= 2;
+				}
+				chunk* c = static_cast<chunk*>(upstream->allocate(next_size));
+				c->previous = chunks;
+				c->size = next_size;
+				chunks = c;
+				next = reinterpret_cast<char*>(c) + sizeof(chunk);
+				limit = reinterpret_cast<char*>(c) + next_size;
+				next_size *= 2;
+				p = align(next, alignment);
+			}
+			next = p + bytes;
+			return p;
+		}
+
+		virtual void do_deallocate(void*, size_t, size_t) {
+		}
+
+		static char* align(char* p, size_t alignment) {
+			return reinterpret_cast<char*>((reinterpret_cast<size_t>(p) + alignment - 1) & ~(alignment - 1));
+		}
+
+		monotonic_buffer_resource(const monotonic_buffer_resource&);
+		monotonic_buffer_resource& operator=(const monotonic_buffer_resource&);
+	};
+
+	// Small blocks from per-size free lists, refilled from chunks that
+	// double; anything bigger goes straight upstream. Everything goes back
+	// when the resource does.
+	class unsynchronized_pool_resource : public memory_resource {
+	public:
+		explicit unsynchronized_pool_resource(memory_resource* upstream_ = new_delete_resource()) : upstream(upstream_), chunks(0) {
+			for(size_t i = 0; i < classes; ++i) {
+				free_lists[i] = 0;
+				next_blocks[i] = 32;
+			}
+		}
+
+		~unsynchronized_pool_resource() {
+			release();
+		}
+
+		void release() {
+			while(chunks) {
+				chunk* c = chunks;
+				chunks = c->previous;
+				upstream->deallocate(c, c->size);
+			}
+			for(size_t i = 0; i < classes; ++i) {
+				free_lists[i] = 0;
+			}
+		}
+
+	private:
+		enum { granule = max_alignment, classes = 16, largest = granule * classes };
+
+		struct chunk {
+			chunk* previous;
+			size_t size;
+			char padding[max_alignment - (2 * sizeof(void*)) % max_alignment];
+		};
+
+		memory_resource* upstream;
+		chunk* chunks;
+		void* free_lists[classes];
+		size_t next_blocks[classes];
+
+		static size_t class_of(size_t bytes) {
+			return bytes == 0 ? 0 : (bytes - 1) / granule;
+		}
+
+		virtual void* do_allocate(size_t bytes, size_t alignment) {
+			if(bytes > largest || alignment > max_alignment) {
+				return upstream->allocate(bytes, alignment);
+			}
+			const size_t c = class_of(bytes);
+			if(!free_lists[c]) {
+				refill(c);
+			}
+			void* p = free_lists[c];
+			free_lists[c] = node_pools_detail::next_of(p);
+			return p;
+		}
+
+		virtual void do_deallocate(void* p, size_t bytes, size_t alignment) {
+			if(bytes > largest || alignment > max_alignment) {
+				upstream->deallocate(p, bytes, alignment);
+				return;
+			}
+			const size_t c = class_of(bytes);
+			node_pools_detail::next_of(p) = free_lists[c];
+			free_lists[c] = p;
+		}
+
+		void refill(size_t c) {
+			const size_t block = (c + 1) * granule;
+			const size_t blocks = next_blocks[c];
+			next_blocks[c] *= 2;
+			const size_t size = sizeof(chunk) + blocks * block;
+			chunk* fresh = static_cast<chunk*>(upstream->allocate(size));
+			fresh->previous = chunks;
+			fresh->size = size;
+			chunks = fresh;
+			char* first = reinterpret_cast<char*>(fresh + 1);
+			for(size_t i = 0; i < blocks; ++i) {
+				node_pools_detail::next_of(first + i * block) = i + 1 < blocks ? first + (i + 1) * block : free_lists[c];
+			}
+			free_lists[c] = first;
+		}
+
+		unsynchronized_pool_resource(const unsynchronized_pool_resource&);
+		unsynchronized_pool_resource& operator=(const unsynchronized_pool_resource&);
+	};
+}
+
+template<typename T>
+class new_store {
+public:
+	static const bool frees_objects = true;
+
+	new_store() {
+	}
+
+	static void reserve(size_t) {
+	}
+
+	template<typename... Args>
+	T* construct(Args&&... args) {
+		T* p = new T(std::forward<Args>(args)...);
+		bytes.add(node_pools_detail::heap_size(p, sizeof(T)));
+		return p;
+	}
+
+	void destroy(T* p) {
+		bytes.add(-node_pools_detail::heap_size(p, sizeof(T)));
+		delete p;
+	}
+
+private:
+	node_pools_detail::meter bytes;
+
+	new_store(const new_store&);
+	new_store& operator=(const new_store&);
+};
+
+template<typename T>
+class object_pool_store {
+public:
+	static const bool frees_objects = false;
+
+	object_pool_store() {
+	}
+
+	static void reserve(size_t) {
+	}
+
+	template<typename... Args>
+	T* construct(Args&&... args) {
+		T* p = pool.malloc();
+		if(!p) {
+			throw std::bad_alloc();
+		}
+		return new(p) T(std::forward<Args>(args)...);
+	}
+
+	void destroy(T* p) {
+		pool.destroy(p);
+	}
+
+private:
+	boost::object_pool<T, node_pools_detail::counted_user_allocator> pool;
+
+	object_pool_store(const object_pool_store&);
+	object_pool_store& operator=(const object_pool_store&);
+};
+
+template<typename T>
+class pool_store {
+public:
+	static const bool frees_objects = false;
+
+	pool_store() : pool(sizeof(T)) {
+	}
+
+	static void reserve(size_t) {
+	}
+
+	template<typename... Args>
+	T* construct(Args&&... args) {
+		void* p = pool.malloc();
+		if(!p) {
+			throw std::bad_alloc();
+		}
+		return new(p) T(std::forward<Args>(args)...);
+	}
+
+	void destroy(T* p) {
+		p->~T();
+		pool.free(p);
+	}
+
+private:
+	boost::pool<node_pools_detail::counted_user_allocator> pool;
+
+	pool_store(const pool_store&);
+	pool_store& operator=(const pool_store&);
+};
+
+template<typename T>
+class arena_store {
+public:
+	static const bool frees_objects = false;
+
+	arena_store() : first(0), current(0), next(0), limit(0) {
+	}
+
+	static void reserve(size_t) {
+	}
+
+	~arena_store() {
+		while(first) {
+			chunk* c = first;
+			first = c->following;
+			node_pools_detail::system_free(c);
+		}
+	}
+
+	template<typename... Args>
+	T* construct(Args&&... args) {
+		if(next == limit) {
+			grow();
+		}
+		T* p = reinterpret_cast<T*>(next);
+		next += sizeof(T);
+		return new(p) T(std::forward<Args>(args)...);
+	}
+
+	void destroy(T*) {
+	}
+
+	// forgets every object, keeping the chunks for the next ones
+	void reset() {
+		current = first;
+		next = current ? current->objects() : 0;
+		limit = current ? next + current->capacity * sizeof(T) : 0;
+	}
+
+private:
+	struct chunk {
+		chunk* following;
+		size_t capacity; // objects
+		char padding[16 - (sizeof(void*) + sizeof(size_t)) % 16];
+
+		char* objects() {
+			return reinterpret_cast<char*>(this + 1);
+		}
+	};
+
+	chunk* first;
+	chunk* current;
+	char* next;
+	char* limit;
+
+	void grow() {
+		if(current && current->following) {
+			current = current->following;
+		} else {
+			const size_t capacity = current ? 2 * current->capacity : 32;
+			chunk* c = static_cast<chunk*>(node_pools_detail::system_allocate(sizeof(chunk) + capacity * sizeof(T)));
+			if(!c) {
+				throw std::bad_alloc();
+			}
+			c->following = 0;
+			c->capacity = capacity;
+			if(current) {
+				current->following = c;
+			} else {
+				first = c;
+			}
+			current = c;
+		}
+		next = current->objects();
+		limit = next + current->capacity * sizeof(T);
+	}
+
+	arena_store(const arena_store&);
+	arena_store& operator=(const arena_store&);
+};
+
+template<typename T, bool Local>
+class thread_arena_store {
+public:
+	static const bool frees_objects = false;
+
+	thread_arena_store() : region(node_pools_detail::this_thread_region<sizeof(T), Local>()), bottom_block(region.current), bottom(region.next) {
+		++region.stores;
+	}
+
+	// everything made since this store was gives its place back
+	~thread_arena_store() {
+		region.current = bottom_block;
+		region.next = bottom;
+		region.limit = bottom_block ? bottom_block->end() : 0;
+		--region.stores;
+	}
+
+	// makes room for n objects in one block, so that building them takes no
+	// more memory from the system
+	static void reserve(size_t n) {
+		node_pools_detail::make_room(node_pools_detail::this_thread_region<sizeof(T), Local>(), n * sizeof(T), Local);
+	}
+
+	template<typename... Args>
+	T* construct(Args&&... args) {
+		if(static_cast<size_t>(region.limit - region.next) < sizeof(T)) {
+			node_pools_detail::make_room(region, sizeof(T), Local);
+		}
+		T* p = reinterpret_cast<T*>(region.next);
+		region.next += sizeof(T);
+		return new(p) T(std::forward<Args>(args)...);
+	}
+
+	void destroy(T*) {
+	}
+
+private:
+	node_pools_detail::thread_region& region;
+	node_pools_detail::region_block* bottom_block;
+	char* bottom;
+
+	thread_arena_store(const thread_arena_store&);
+	thread_arena_store& operator=(const thread_arena_store&);
+};
+
+template<typename T>
+class slab_store {
+public:
+	static const bool frees_objects = true;
+
+	slab_store() {
+	}
+
+	static void reserve(size_t) {
+	}
+
+	template<typename... Args>
+	T* construct(Args&&... args) {
+		return new(node_pools_detail::slab_allocate<sizeof(T)>()) T(std::forward<Args>(args)...);
+	}
+
+	void destroy(T* p) {
+		p->~T();
+		node_pools_detail::slab_free<sizeof(T)>(p);
+	}
+
+private:
+	slab_store(const slab_store&);
+	slab_store& operator=(const slab_store&);
+};
+
+template<typename T, typename Resource, bool FreesObjects>
+class pmr_store {
+public:
+	static const bool frees_objects = FreesObjects;
+
+	pmr_store() : resource(&owned) {
+	}
+
+	static void reserve(size_t) {
+	}
+
+	template<typename... Args>
+	T* construct(Args&&... args) {
+		return new(resource->allocate(sizeof(T), std::alignment_of<T>::value)) T(std::forward<Args>(args)...);
+	}
+
+	void destroy(T* p) {
+		p->~T();
+		resource->deallocate(p, sizeof(T), std::alignment_of<T>::value);
+	}
+
+private:
+	Resource owned;
+	// allocations go through the abstract interface, as they would through
+	// a polymorphic_allocator
+	pmr_style::memory_resource* resource;
+
+	pmr_store(const pmr_store&);
+	pmr_store& operator=(const pmr_store&);
+};
+
+inline const std::vector<std::string>& node_pool_names() {
+	static const char* const names[] = { "new", "object_pool", "pool", "arena", "thread-arena", "numa-arena", "slab", "pmr-monotonic", "pmr-pool" };
+	static const std::vector<std::string> all(names, names + sizeof(names) / sizeof(*names));
+	return all;
+}
+
+template<typename T, typename Visitor>
+bool with_node_pool(const std::string& name, Visitor& visitor) {
+	if(name == "new") {
+		visitor.template visit<new_store<T> >();
+	} else if(name == "object_pool") {
+		visitor.template visit<object_pool_store<T> >();
+	} else if(name == "pool") {
+		visitor.template visit<pool_store<T> >();
+	} else if(name == "arena") {
+		visitor.template visit<arena_store<T> >();
+	} else if(name == "thread-arena") {
+		visitor.template visit<thread_arena_store<T, false> >();
+	} else if(name == "numa-arena") {
+		visitor.template visit<thread_arena_store<T, true> >();
+	} else if(name == "slab") {
+		visitor.template visit<slab_store<T> >();
+	} else if(name == "pmr-monotonic") {
+		visitor.template visit<pmr_store<T, pmr_style::monotonic_buffer_resource, false> >();
+	} else if(name == "pmr-pool") {
+		visitor.template visit<pmr_store<T, pmr_style::unsynchronized_pool_resource, true> >();
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// the calling thread's thread-arena and numa-arena regions for T, if no
+// store is using them
+template<typename T>
+void release_thread_regions() {
+	node_pools_detail::release_region<sizeof(T), false>();
+	node_pools_detail::release_region<sizeof(T), true>();
+}
+
+inline long long pool_bytes() {
+	return node_pools_detail::shared().live;
+}
+
+inline long long peak_pool_bytes() {
+	return node_pools_detail::shared().peak;
+}
+
+// starts a new high-water mark from what is held now
+inline void reset_peak_pool_bytes() {
+	node_pools_detail::shared_bytes& all = node_pools_detail::shared();
+	all.peak = all.live;
+}
+
+#endif
@@ -0,0 +1,348 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// A sampling profiler for hosts without perf. With
+//
+//   BENCH_PROFILE=<file>       write folded stacks to <file>
+//   BENCH_PROFILE_HZ=<n>       samples per second of CPU time       (997)
+//   BENCH_PROFILE_SAMPLES=<n>  samples kept                         (32768)
+//
+// a CPU-time interval timer (setitimer ITIMER_PROF) interrupts whichever
+// thread is running, OpenMP's included, and the SIGPROF handler stores that
+// thread's backtrace in a ring buffer. Writers claim slots with an atomic
+// increment and take no locks, so the handler is safe to run on any number
+// of threads at once. When the ring wraps the oldest samples are
+// overwritten, which keeps the timed runs over the warmups.
+//
+// Nothing is symbolized until exit: then each address is looked up with
+// dladdr, falling back to the ELF symbol table of the executable or library
+// it belongs to so that static functions get names too, and the stacks are
+// written as "outer;inner;leaf count" lines, the input of flamegraph.pl
+// and speedscope. Functions that were inlined show up as their callers.
+//
+// Linux (glibc) only; elsewhere BENCH_PROFILE just says it is unsupported.
+
+#if defined(__linux__) && defined(__GLIBC__) && !defined(EMSCRIPTEN)
+#define PROFILER_SUPPORTED 1
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#ifdef PROFILER_SUPPORTED
+
+namespace profiler_detail {
+	// deep enough for meteor-contest's recursion; deeper stacks lose their
+	// outermost frames and are marked as truncated
+	const int max_depth = 128;
+	// the handler's own frame and the signal trampoline
+	const int skipped_frames = 2;
+
+	struct sample {
+		volatile unsigned long long sequence; // claim number + 1 once complete, 0 while being written
+		int thread;
+		int depth;
+		void* frames[max_depth];
+	};
+
+	struct ring {
+		sample* samples;
+		unsigned long long capacity;
+		volatile unsigned long long claimed;
+	};
+
+	// plain data, so that the handler never sees it half constructed
+	inline ring& samples() {
+		static ring r;
+		return r;
+	}
+
+	inline void on_sigprof(int, siginfo_t*, void*) {
+		const int saved_errno = errno;
+		ring& r = samples();
+		if(r.samples) {
+			const unsigned long long claim = __sync_fetch_and_add(&r.claimed, 1ull);
+			sample& s = r.samples[claim % r.capacity];
+			s.sequence = 0;
+			__sync_synchronize();
+			s.thread = static_cast<int>(::syscall(SYS_gettid));
+			s.depth = ::backtrace(s.frames, max_depth);
+			__sync_synchronize();
+			s.sequence = claim + 1;
+		}
+		errno = saved_errno;
+	}
+
+	// symbols of one ELF file, sorted by address, for what dladdr cannot name
+	struct symbol_table {
+		bool relative; // symbol values are offsets from the load address
+		std::vector<std::pair<unsigned long long, std::string> > symbols;
+		std::vector<unsigned long long> sizes;
+
+		symbol_table() : relative(true) {
+		}
+
+		void load(const std::string& path) {
+			std::ifstream in(path.c_str(), std::ios_base::in | std::ios_base::binary);
+			std::ostringstream os;
+			os << in.rdbuf();
+			const std::string image = os.str();
+			if(image.size() < sizeof(Elf64_Ehdr) || image.compare(0, 4, ELFMAG) != 0 || image[EI_CLASS] != ELFCLASS64) {
+				return;
+			}
+			const char* base = image.data();
+			const Elf64_Ehdr* header = reinterpret_cast<const Elf64_Ehdr*>(base);
+			relative = header->e_type != ET_EXEC;
+			if(header->e_shoff == 0 || header->e_shoff + header->e_shnum * sizeof(Elf64_Shdr) > image.size()) {
+				return;
+			}
+			const Elf64_Shdr* sections = reinterpret_cast<const Elf64_Shdr*>(base + header->e_shoff);
+			std::vector<std::pair<std::pair<unsigned long long, unsigned long long>, std::string> > found;
+			for(int i = 0; i < header->e_shnum; ++i) {
+				if(sections[i].sh_type != SHT_SYMTAB || sections[i].sh_link >= header->e_shnum) {
+					continue;
+				}
+				const Elf64_Shdr& names = sections[sections[i].sh_link];
+				if(sections[i].sh_offset + sections[i].sh_size > image.size() || names.sh_offset + names.sh_size > image.size()) {
+					continue;
+				}
+				const Elf64_Sym* symbol = reinterpret_cast<const Elf64_Sym*>(base + sections[i].sh_offset);
+				const size_t count = sections[i].sh_size / sizeof(Elf64_Sym);
+				for(size_t j = 0; j < count; ++j) {
+					if(ELF64_ST_TYPE(symbol[j].st_info) == STT_FUNC && symbol[j].st_value != 0 && symbol[j].st_name < names.sh_size) {
+						found.push_back(std::make_pair(std::make_pair(symbol[j].st_value, symbol[j].st_size), std::string(base + names.sh_offset + symbol[j].st_name)));
+					}
+				}
+			}
+			std::sort(found.begin(), found.end());
+			for(size_t i = 0; i < found.size(); ++i) {
+				symbols.push_back(std::make_pair(found[i].first.first, found[i].second));
+				sizes.push_back(found[i].first.second);
+			}
+		}
+
+		// empty if the address is in no function
+		std::string lookup(unsigned long long address) const {
+			std::vector<std::pair<unsigned long long, std::string> >::const_iterator it =
+				std::upper_bound(symbols.begin(), symbols.end(), std::make_pair(address, std::string("\xff")));
+			if(it == symbols.begin()) {
+				return std::string();
+			}
+			--it;
+			const size_t index = static_cast<size_t>(it - symbols.begin());
+			if(sizes[index] != 0 && address >= it->first + sizes[index]) {
+				return std::string();
+			}
+			return it->second;
+		}
+	};
+
+	class symbolizer {
+	public:
+		symbolizer() {
+		}
+
+		std::string name(void* address) {
+			std::map<void*, std::string>::const_iterator known = names.find(address);
+			if(known != names.end()) {
+				return known->second;
+			}
+			// return addresses point after the call; look up the call itself
+			void* call = static_cast<char*>(address) - 1;
+			std::string symbol;
+			std::string object = "[unknown]";
+			Dl_info info;
+			if(::dladdr(call, &info) != 0) {
+				if(info.dli_sname) {
+					symbol = info.dli_sname;
+				}
+				if(info.dli_fname && *info.dli_fname) {
+					object = info.dli_fname;
+					const std::string::size_type slash = object.rfind('/');
+					if(slash != std::string::npos) {
+						object = object.substr(slash + 1);
+					}
+				}
+				if(symbol.empty() && info.dli_fname) {
+					const symbol_table& table = symbols_of(info.dli_fname);
+					const unsigned long long at = reinterpret_cast<unsigned long long>(call);
+					symbol = table.lookup(table.relative ? at - reinterpret_cast<unsigned long long>(info.dli_fbase) : at);
+				}
+			}
+			std::string result = symbol.empty() ? object : demangle(symbol);
+			names[address] = result;
+			return result;
+		}
+
+	private:
+		symbolizer(const symbolizer&);
+		symbolizer& operator=(const symbolizer&);
+
+		const symbol_table& symbols_of(const char* path) {
+			std::map<std::string, symbol_table>::iterator it = tables.find(path);
+			if(it == tables.end()) {
+				it = tables.insert(std::make_pair(std::string(path), symbol_table())).first;
+				// the main program's dli_fname is argv[0], which may be relative;
+				// libraries' are absolute
+				it->second.load(path[0] == '/' ? path : "/proc/self/exe");
+			}
+			return it->second;
+		}
+
+		static std::string demangle(const std::string& symbol) {
+			int status = 0;
+			char* readable = abi::__cxa_demangle(symbol.c_str(), 0, 0, &status);
+			std::string result = status == 0 && readable ? readable : symbol;
+			std::free(readable);
+			// ';' separates frames in the folded format
+			std::replace(result.begin(), result.end(), ';', ':');
+			return result;
+		}
+
+		std::map<void*, std::string> names;
+		std::map<std::string, symbol_table> tables;
+	};
+
+	class profiler {
+	public:
+		static profiler& instance() {
+			static profiler p;
+			return p;
+		}
+
+		~profiler() {
+			if(path.empty()) {
+				return;
+			}
+			struct itimerval off = {};
+			::setitimer(ITIMER_PROF, &off, 0);
+			::signal(SIGPROF, SIG_IGN);
+			write();
+		}
+
+	private:
+		profiler() : hz(997) {
+			const char* file = std::getenv("BENCH_PROFILE");
+			if(!file || !*file) {
+				return;
+			}
+			const char* rate = std::getenv("BENCH_PROFILE_HZ");
+			if(rate && std::atoi(rate) > 0) {
+				hz = std::atoi(rate);
+			}
+			const char* kept = std::getenv("BENCH_PROFILE_SAMPLES");
+			ring& r = samples();
+			r.capacity = kept && std::atoi(kept) > 0 ? static_cast<unsigned long long>(std::atoi(kept)) : 32768ull;
+			r.samples = static_cast<sample*>(std::calloc(r.capacity, sizeof(sample)));
+			if(!r.samples) {
+				std::cerr << "profiler: cannot allocate " << r.capacity << " samples" << std::endl;
+				return;
+			}
+			// the first backtrace() loads the unwinder, which is not safe
+			// inside a signal handler; get that over with here
+			void* frames[4];
+			::backtrace(frames, 4);
+
+			struct sigaction action = {};
+			action.sa_sigaction = on_sigprof;
+			action.sa_flags = SA_SIGINFO | SA_RESTART;
+			sigemptyset(&action.sa_mask);
+			if(::sigaction(SIGPROF, &action, 0) != 0) {
+				std::cerr << "profiler: cannot install the SIGPROF handler" << std::endl;
+				return;
+			}
+			struct itimerval interval = {};
+			interval.it_interval.tv_sec = 0;
+			interval.it_interval.tv_usec = std::max(1, 1000000 / hz);
+			interval.it_value = interval.it_interval;
+			if(::setitimer(ITIMER_PROF, &interval, 0) != 0) {
+				std::cerr << "profiler: cannot start the profiling timer" << std::endl;
+				return;
+			}
+			path = file;
+		}
+
+		profiler(const profiler&);
+		profiler& operator=(const profiler&);
+
+		void write() {
+			ring& r = samples();
+			const unsigned long long claimed = r.claimed;
+			const unsigned long long kept = std::min(claimed, r.capacity);
+			symbolizer symbols;
+			std::map<std::string, unsigned long long> stacks;
+			std::vector<int> threads;
+			unsigned long long complete = 0;
+			for(unsigned long long i = 0; i < kept; ++i) {
+				const sample& s = r.samples[i];
+				if(s.sequence == 0 || s.depth <= skipped_frames) {
+					continue;
+				}
+				++complete;
+				if(std::find(threads.begin(), threads.end(), s.thread) == threads.end()) {
+					threads.push_back(s.thread);
+				}
+				std::string stack = s.depth == max_depth ? "[truncated]" : "";
+				for(int f = s.depth - 1; f >= skipped_frames; --f) {
+					stack += (stack.empty() ? "" : ";") + symbols.name(s.frames[f]);
+				}
+				++stacks[stack];
+			}
+			std::ofstream out(path.c_str(), std::ios_base::out | std::ios_base::trunc);
+			for(std::map<std::string, unsigned long long>::const_iterator it = stacks.begin(); it != stacks.end(); ++it) {
+				out << it->first << " " << it->second << "\n";
+			}
+			std::cerr << "profile: " << complete << " samples from " << threads.size() << " thread" << (threads.size() == 1 ? "" : "s")
+			          << " at " << hz << " Hz";
+			if(claimed > r.capacity) {
+				std::cerr << ", " << claimed - r.capacity << " oldest overwritten (BENCH_PROFILE_SAMPLES " << r.capacity << ")";
+			}
+			std::cerr << (out ? ", written to " : ", cannot write ") << path << std::endl;
+			std::free(r.samples);
+			r.samples = 0;
+		}
+
+		int hz;
+		std::string path;
+	};
+
+	// started before main(), so that everything the kernel does is sampled,
+	// and stopped (and written) after it returns
+	static struct profiler_initializer {
+		profiler_initializer() {
+			profiler::instance();
+		}
+	} initialize_profiler;
+}
+
+#else
+
+namespace profiler_detail {
+	static struct profiler_initializer {
+		profiler_initializer() {
+			const char* file = std::getenv("BENCH_PROFILE");
+			if(file && *file) {
+				std::cerr << "profiler: BENCH_PROFILE is not supported on this platform" << std::endl;
+			}
+		}
+	} initialize_profiler;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,371 @@
+#ifndef REGIONS_HPP
+#define REGIONS_HPP
+
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "timer.hpp"
+#include "allocations.hpp"
+
+// Nested timing regions. Put a
+//
+//   scoped_region region("reverse_complement");
+//
+// at the top of a phase and its time is charged to that name, nested under
+// whichever region was open on the same thread when it started. Each thread
+// records into its own tree, found through a thread-local pointer, so regions
+// inside OpenMP loops take no locks; the only lock is taken once per thread,
+// when its tree is first registered.
+//
+// Recording is off unless BENCH_REGIONS=1 or BENCH_TRACE is set. With the
+// former, the trees of all threads are merged by path at exit and printed to
+// stderr with call counts, inclusive and exclusive times. Times summed over
+// threads are CPU time, not wall time, so a parallel region can be "longer"
+// than its parent. Builds that count allocations (see allocations.hpp) also
+// get each region's allocations and allocated bytes, inclusive of its
+// children.
+//
+// BENCH_TRACE=<file> also keeps every entry into every region, with its
+// thread and its start and end on the same clock, and writes them at exit
+// as a Chrome trace-event JSON file (one complete "X" event per entry) for
+// chrome://tracing or ui.perfetto.dev. That shows what the table averages
+// away: which thread ran which rows or depths when, and who sat idle.
+// Threads are numbered in the order they first entered a region. Tracing
+// keeps an event per entry in memory, so trace a small problem size.
+//
+// Region names must be string literals (or otherwise outlive the program):
+// only the pointer is kept.
+
+#if defined(_MSC_VER)
+#define REGIONS_THREAD_LOCAL __declspec(thread)
+#else
+#define REGIONS_THREAD_LOCAL __thread
+#endif
+
+namespace regions_detail {
+	// the TSC where there is one, so that regions are cheap enough for inner loops
+	typedef fine_grained_timer::clock_type clock_type;
+
+	struct node {
+		const char* name;
+		size_t parent;
+		std::vector<size_t> children;
+		unsigned long long calls;
+		clock_type::duration inclusive;
+		unsigned long long allocations;
+		unsigned long long allocated_bytes;
+
+		node(const char* name_, size_t parent_) : name(name_), parent(parent_), calls(0), inclusive(clock_type::duration::zero()), allocations(0), allocated_bytes(0) {
+		}
+	};
+
+	struct frame {
+		size_t index;
+		clock_type::time_point start;
+		allocation_counts allocated;
+	};
+
+	struct trace_event {
+		const char* name;
+		clock_type::time_point start;
+		clock_type::time_point end;
+	};
+
+	// one per thread; node 0 is the root and never timed
+	struct thread_tree {
+		std::vector<node> nodes;
+		std::vector<frame> stack;
+		size_t current;
+		unsigned id;
+		bool tracing;
+		std::vector<trace_event> events;
+
+		thread_tree(unsigned id_, bool tracing_) : current(0), id(id_), tracing(tracing_) {
+			nodes.push_back(node("", 0));
+		}
+
+		void enter(const char* name) {
+			size_t child = find_child(name);
+			frame f = { child, clock_type::time_point(), allocation_counts() };
+			stack.push_back(f);
+			current = child;
+			stack.back().allocated = thread_allocations();
+			stack.back().start = clock_type::now();
+		}
+
+		void leave() {
+			const clock_type::time_point now = clock_type::now();
+			if(stack.empty()) {
+				return;
+			}
+			const allocation_counts allocated = thread_allocations();
+			node& n = nodes[stack.back().index];
+			n.inclusive += now - stack.back().start;
+			n.allocations += allocated.allocations - stack.back().allocated.allocations;
+			n.allocated_bytes += allocated.bytes - stack.back().allocated.bytes;
+			++n.calls;
+			if(tracing) {
+				trace_event e = { n.name, stack.back().start, now };
+				events.push_back(e);
+			}
+			current = n.parent;
+			stack.pop_back();
+		}
+
+	private:
+		size_t find_child(const char* name) {
+			const std::vector<size_t>& children = nodes[current].children;
+			for(size_t i = 0; i < children.size(); ++i) {
+				const char* other = nodes[children[i]].name;
+				if(other == name || std::strcmp(other, name) == 0) {
+					return children[i];
+				}
+			}
+			nodes.push_back(node(name, current));
+			nodes[current].children.push_back(nodes.size() - 1);
+			return nodes.size() - 1;
+		}
+	};
+
+	// merged view of all the threads' trees
+	struct merged_node {
+		std::string name;
+		unsigned long long calls;
+		double inclusive; // microseconds
+		unsigned long long allocations;
+		unsigned long long allocated_bytes;
+		unsigned threads;
+		std::vector<merged_node> children;
+
+		merged_node(const std::string& name_) : name(name_), calls(0), inclusive(0.0), allocations(0), allocated_bytes(0), threads(0) {
+		}
+
+		merged_node& child(const std::string& child_name) {
+			for(size_t i = 0; i < children.size(); ++i) {
+				if(children[i].name == child_name) {
+					return children[i];
+				}
+			}
+			children.push_back(merged_node(child_name));
+			return children.back();
+		}
+	};
+
+	class registry {
+	public:
+		static registry& instance() {
+			static registry r;
+			return r;
+		}
+
+		bool enabled() const {
+			return on;
+		}
+
+		thread_tree* register_thread() {
+			std::lock_guard<std::mutex> guard(lock);
+			thread_tree* tree = new thread_tree(static_cast<unsigned>(trees.size()), !trace_path.empty());
+			trees.push_back(tree);
+			return tree;
+		}
+
+		void print(std::ostream& os) {
+			std::lock_guard<std::mutex> guard(lock);
+			merged_node root("");
+			for(size_t t = 0; t < trees.size(); ++t) {
+				merge(root, *trees[t], 0);
+			}
+			if(root.children.empty()) {
+				return;
+			}
+			std::ios_base::fmtflags flags = os.flags();
+			std::streamsize precision = os.precision();
+			os.setf(std::ios_base::fixed, std::ios_base::floatfield);
+			os.precision(1);
+			os << std::left << std::setw(40) << "region" << std::right
+			   << std::setw(12) << "calls"
+			   << std::setw(16) << "inclusive us"
+			   << std::setw(16) << "exclusive us"
+			   << std::setw(9) << "threads";
+			if(allocations_tracked()) {
+				os << std::setw(14) << "allocations" << std::setw(16) << "alloc bytes";
+			}
+			os << "\n";
+			for(size_t i = 0; i < root.children.size(); ++i) {
+				print(os, root.children[i], 0);
+			}
+			os.flush();
+			os.flags(flags);
+			os.precision(precision);
+		}
+
+	private:
+		registry() : on(false), table(false) {
+			const char* value = std::getenv("BENCH_REGIONS");
+			table = value && *value && std::atoi(value) != 0;
+			const char* trace = std::getenv("BENCH_TRACE");
+			if(trace && *trace) {
+				trace_path = trace;
+			}
+			on = table || !trace_path.empty();
+			if(on) {
+				// the clock may calibrate itself on first use; do that now
+				// rather than inside the first region
+				epoch = clock_type::now();
+			}
+		}
+
+		~registry() {
+			if(table) {
+				print(std::cerr);
+			}
+			if(!trace_path.empty()) {
+				write_trace();
+			}
+			for(size_t t = 0; t < trees.size(); ++t) {
+				delete trees[t];
+			}
+		}
+
+		registry(const registry&);
+		registry& operator=(const registry&);
+
+		static void write_name(std::ostream& os, const char* name) {
+			os << '"';
+			for(const char* c = name; *c; ++c) {
+				if(*c == '"' || *c == '\\') {
+					os << '\\' << *c;
+				} else if(static_cast<unsigned char>(*c) < 0x20) {
+					char escaped[8];
+					std::sprintf(escaped, "\\u%04x", static_cast<unsigned char>(*c));
+					os << escaped;
+				} else {
+					os << *c;
+				}
+			}
+			os << '"';
+		}
+
+		double since_epoch(clock_type::time_point t) const {
+			return std::chrono::duration_cast<std::chrono::duration<double, std::micro> >(t - epoch).count();
+		}
+
+		void write_trace() {
+			std::lock_guard<std::mutex> guard(lock);
+			std::ofstream os(trace_path.c_str(), std::ios_base::out | std::ios_base::trunc);
+			os.setf(std::ios_base::fixed, std::ios_base::floatfield);
+			os.precision(3);
+			os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+			os << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"benchmark\"}}";
+			size_t count = 0;
+			for(size_t t = 0; t < trees.size(); ++t) {
+				const thread_tree& tree = *trees[t];
+				os << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tree.id
+				   << ",\"args\":{\"name\":\"thread " << tree.id << "\"}}";
+				os << ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tree.id
+				   << ",\"args\":{\"sort_index\":" << tree.id << "}}";
+				for(size_t i = 0; i < tree.events.size(); ++i) {
+					const trace_event& e = tree.events[i];
+					os << ",\n{\"name\":";
+					write_name(os, e.name);
+					os << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tree.id
+					   << ",\"ts\":" << since_epoch(e.start)
+					   << ",\"dur\":" << since_epoch(e.end) - since_epoch(e.start) << "}";
+				}
+				count += tree.events.size();
+			}
+			os << "\n]}\n";
+			std::cerr << "trace: " << count << " events from " << trees.size() << " thread" << (trees.size() == 1 ? "" : "s")
+			          << (os ? ", written to " : ", cannot write ") << trace_path << std::endl;
+		}
+
+		static void merge(merged_node& into, const thread_tree& tree, size_t index) {
+			const std::vector<size_t>& children = tree.nodes[index].children;
+			for(size_t i = 0; i < children.size(); ++i) {
+				const node& n = tree.nodes[children[i]];
+				merged_node& m = into.child(n.name);
+				m.calls += n.calls;
+				m.inclusive += std::chrono::duration_cast<std::chrono::duration<double, std::micro> >(n.inclusive).count();
+				m.allocations += n.allocations;
+				m.allocated_bytes += n.allocated_bytes;
+				m.threads += 1;
+				merge(m, tree, children[i]);
+			}
+		}
+
+		static void print(std::ostream& os, const merged_node& n, int depth) {
+			double children = 0.0;
+			for(size_t i = 0; i < n.children.size(); ++i) {
+				children += n.children[i].inclusive;
+			}
+			const std::string label = std::string(2 * depth, ' ') + n.name;
+			os << std::left << std::setw(40) << label << std::right
+			   << std::setw(12) << n.calls
+			   << std::setw(16) << n.inclusive
+			   << std::setw(16) << (n.inclusive > children ? n.inclusive - children : 0.0)
+			   << std::setw(9) << n.threads;
+			if(allocations_tracked()) {
+				os << std::setw(14) << n.allocations << std::setw(16) << n.allocated_bytes;
+			}
+			os << "\n";
+			for(size_t i = 0; i < n.children.size(); ++i) {
+				print(os, n.children[i], depth + 1);
+			}
+		}
+
+		bool on;
+		bool table;
+		std::string trace_path;
+		clock_type::time_point epoch;
+		std::mutex lock;
+		std::vector<thread_tree*> trees;
+	};
+
+	inline thread_tree* this_thread_tree() {
+		static REGIONS_THREAD_LOCAL thread_tree* tree = 0;
+		if(!tree) {
+			tree = registry::instance().register_thread();
+		}
+		return tree;
+	}
+
+	// constructed before main() so that the registry exists (and is thus
+	// destroyed, printing its report) before any kernel thread can race to
+	// create it
+	static struct registry_initializer {
+		registry_initializer() {
+			registry::instance();
+		}
+	} initialize_registry;
+}
+
+struct scoped_region {
+	explicit scoped_region(const char* name) : tree(0) {
+		if(regions_detail::registry::instance().enabled()) {
+			tree = regions_detail::this_thread_tree();
+			tree->enter(name);
+		}
+	}
+
+	~scoped_region() {
+		if(tree) {
+			tree->leave();
+		}
+	}
+
+private:
+	scoped_region(const scoped_region&);
+	scoped_region& operator=(const scoped_region&);
+
+	regions_detail::thread_tree* tree;
+};
+
+#endif
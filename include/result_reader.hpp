@@ -0,0 +1,84 @@
+#ifndef RESULT_READER_HPP
+#define RESULT_READER_HPP
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Reads back the CSV records written by results.h, for the tools that
+// post-process benchmark runs.
+
+struct result_row {
+	std::string timestamp;
+	std::string kernel;
+	std::string variant;
+	std::string size;
+	int threads;
+	std::string metric;
+	double value;
+	std::string unit;
+	std::string check;
+};
+
+inline std::vector<std::string> split_csv(const std::string& line)
+{
+	std::vector<std::string> fields;
+	std::string field;
+	bool quoted = false;
+	for(size_t i = 0; i < line.size(); ++i) {
+		const char c = line[i];
+		if(quoted) {
+			if(c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+				field += '"';
+				++i;
+			} else if(c == '"') {
+				quoted = false;
+			} else {
+				field += c;
+			}
+		} else if(c == '"') {
+			quoted = true;
+		} else if(c == ',') {
+			fields.push_back(field);
+			field.clear();
+		} else if(c != '\r') {
+			field += c;
+		}
+	}
+	fields.push_back(field);
+	return fields;
+}
+
+// appends every record row in the file to rows; false if it cannot be read
+inline bool read_result_rows(const std::string& path, std::vector<result_row>& rows)
+{
+	std::ifstream in(path.c_str());
+	if(!in) {
+		std::cerr << "cannot read " << path << std::endl;
+		return false;
+	}
+	std::string line;
+	while(std::getline(in, line)) {
+		// timestamp,kernel,variant,size,threads,metric,value,unit,check
+		std::vector<std::string> f = split_csv(line);
+		if(f.size() < 9 || f[0] == "timestamp") {
+			continue;
+		}
+		result_row row;
+		row.timestamp = f[0];
+		row.kernel = f[1];
+		row.variant = f[2];
+		row.size = f[3];
+		row.threads = std::atoi(f[4].c_str());
+		row.metric = f[5];
+		row.value = std::atof(f[6].c_str());
+		row.unit = f[7];
+		row.check = f[8];
+		rows.push_back(row);
+	}
+	return true;
+}
+
+#endif
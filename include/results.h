@@ -0,0 +1,336 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+/* Structured result records, usable from both the C and the C++ kernels.
+ *
+ * A kernel fills in one bench_result per run, calls bench_result_emit() and
+ * then bench_result_free(), which releases the metrics (they grow as needed).
+ * Nothing is written unless BENCH_FORMAT is set:
+ *
+ *   BENCH_FORMAT   json - one JSON object per line
+ *                  csv  - one row per metric, every row carrying the run's
+ *                         timestamp, kernel, variant, size and threads, so
+ *                         the rows of a run group back together
+ *   BENCH_RESULTS  file to append records to (default: stderr)
+ *
+ * Everything is static/inline so the header can be included without a
+ * separate translation unit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#elif !defined(EMSCRIPTEN)
+#include <sys/resource.h>
+#endif
+
+#if defined(__cplusplus)
+#define RESULTS_API inline
+#elif defined(_MSC_VER)
+#define RESULTS_API static __inline
+#else
+#define RESULTS_API static __inline__
+#endif
+
+#define RESULTS_INITIAL_METRICS 64
+
+enum bench_format {
+	BENCH_FORMAT_NONE,
+	BENCH_FORMAT_JSON,
+	BENCH_FORMAT_CSV
+};
+
+typedef struct bench_metric {
+	char name[40];
+	double value;
+	char unit[16];
+} bench_metric;
+
+typedef struct bench_result {
+	char kernel[64];
+	char variant[32];
+	char size[64];
+	int threads;
+	long long timestamp;
+	char check[256];
+	int metric_count;
+	int metric_capacity;
+	int metrics_dropped; /* ones there was no memory for */
+	bench_metric* metrics;
+} bench_result;
+
+RESULTS_API void results_copy(char* dest, size_t capacity, const char* src)
+{
+	size_t length = src ? strlen(src) : 0;
+	if(length >= capacity) {
+		length = capacity - 1;
+	}
+	if(length) {
+		memcpy(dest, src, length);
+	}
+	dest[length] = '\0';
+}
+
+RESULTS_API void bench_result_init(bench_result* r, const char* kernel, const char* variant, const char* size)
+{
+	memset(r, 0, sizeof(*r));
+	results_copy(r->kernel, sizeof(r->kernel), kernel);
+	results_copy(r->variant, sizeof(r->variant), variant);
+	results_copy(r->size, sizeof(r->size), size);
+#ifdef _OPENMP
+	r->threads = omp_get_max_threads();
+#else
+	r->threads = 1;
+#endif
+	r->timestamp = (long long)time(NULL);
+}
+
+/* Takes the kernel and variant from the program name, which is always
+ * <kernel>-<variant>[.exe], e.g. "fasta-redux-optimized". Anything after
+ * the variant word (as in "binary-trees-optimized-pgo") stays part of the
+ * variant. */
+RESULTS_API void bench_result_init_from_program(bench_result* r, const char* program, const char* size)
+{
+	static const char* const variants[] = { "-generic", "-optimized" };
+	char name[96];
+	const char* base = program ? program : "";
+	const char* p;
+	char* variant = NULL;
+	char* extension;
+	size_t i;
+
+	for(p = base; *p; ++p) {
+		if(*p == '/' || *p == '\\') {
+			base = p + 1;
+		}
+	}
+	results_copy(name, sizeof(name), base);
+	extension = strstr(name, ".exe");
+	if(extension) {
+		*extension = '\0';
+	}
+	for(i = 0; i < sizeof(variants) / sizeof(*variants) && !variant; ++i) {
+		variant = strstr(name, variants[i]);
+	}
+	if(!variant) {
+		variant = strrchr(name, '-');
+	}
+	if(variant) {
+		*variant++ = '\0';
+	}
+	bench_result_init(r, name, variant ? variant : "", size);
+}
+
+RESULTS_API void bench_result_metric(bench_result* r, const char* name, double value, const char* unit)
+{
+	bench_metric* m;
+	if(r->metric_count == r->metric_capacity) {
+		const int capacity = r->metric_capacity ? 2 * r->metric_capacity : RESULTS_INITIAL_METRICS;
+		m = (bench_metric*)realloc(r->metrics, (size_t)capacity * sizeof(bench_metric));
+		if(!m) {
+			++r->metrics_dropped;
+			return;
+		}
+		r->metrics = m;
+		r->metric_capacity = capacity;
+	}
+	m = &r->metrics[r->metric_count++];
+	results_copy(m->name, sizeof(m->name), name);
+	m->value = value;
+	results_copy(m->unit, sizeof(m->unit), unit);
+}
+
+RESULTS_API void bench_result_free(bench_result* r)
+{
+	free(r->metrics);
+	r->metrics = NULL;
+	r->metric_count = 0;
+	r->metric_capacity = 0;
+}
+
+RESULTS_API void bench_result_check(bench_result* r, const char* check)
+{
+	results_copy(r->check, sizeof(r->check), check);
+}
+
+RESULTS_API int bench_result_format(void)
+{
+	const char* format = getenv("BENCH_FORMAT");
+	if(!format) {
+		return BENCH_FORMAT_NONE;
+	}
+	if(strcmp(format, "json") == 0) {
+		return BENCH_FORMAT_JSON;
+	}
+	if(strcmp(format, "csv") == 0) {
+		return BENCH_FORMAT_CSV;
+	}
+	return BENCH_FORMAT_NONE;
+}
+
+RESULTS_API void results_json_string(FILE* f, const char* s)
+{
+	fputc('"', f);
+	for(; *s; ++s) {
+		unsigned char c = (unsigned char)*s;
+		switch(c) {
+		case '"':  fputs("\\\"", f); break;
+		case '\\': fputs("\\\\", f); break;
+		case '\n': fputs("\\n", f);  break;
+		case '\r': fputs("\\r", f);  break;
+		case '\t': fputs("\\t", f);  break;
+		default:
+			if(c < 0x20) {
+				fprintf(f, "\\u%04x", c);
+			} else {
+				fputc(c, f);
+			}
+		}
+	}
+	fputc('"', f);
+}
+
+/* High-water mark of the process's resident set in bytes, or -1 if the
+ * platform cannot say. */
+RESULTS_API long long results_peak_rss(void)
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return (long long)counters.PeakWorkingSetSize;
+	}
+	return -1;
+#elif defined(EMSCRIPTEN)
+	return -1;
+#else
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0) {
+		return -1;
+	}
+#ifdef __APPLE__
+	return (long long)usage.ru_maxrss;
+#else
+	return (long long)usage.ru_maxrss * 1024; /* kilobytes */
+#endif
+#endif
+}
+
+/* Adds the peak resident set size, where it is known, as "peak_rss". */
+RESULTS_API void bench_result_peak_rss(bench_result* r)
+{
+	const long long peak = results_peak_rss();
+	if(peak >= 0) {
+		bench_result_metric(r, "peak_rss", (double)peak, "bytes");
+	}
+}
+
+/* CSV fields are quoted whenever they contain a separator, quote or newline */
+RESULTS_API void results_csv_string(FILE* f, const char* s)
+{
+	if(strpbrk(s, ",\"\r\n") == NULL) {
+		fputs(s, f);
+		return;
+	}
+	fputc('"', f);
+	for(; *s; ++s) {
+		if(*s == '"') {
+			fputc('"', f);
+		}
+		fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+RESULTS_API void results_write_json(FILE* f, const bench_result* r)
+{
+	int i;
+	fputs("{\"kernel\":", f);
+	results_json_string(f, r->kernel);
+	fputs(",\"variant\":", f);
+	results_json_string(f, r->variant);
+	fputs(",\"size\":", f);
+	results_json_string(f, r->size);
+	fprintf(f, ",\"threads\":%d,\"timestamp\":%lld,\"metrics\":[", r->threads, r->timestamp);
+	for(i = 0; i < r->metric_count; ++i) {
+		fputs(i ? ",{\"name\":" : "{\"name\":", f);
+		results_json_string(f, r->metrics[i].name);
+		fprintf(f, ",\"value\":%.17g,\"unit\":", r->metrics[i].value);
+		results_json_string(f, r->metrics[i].unit);
+		fputc('}', f);
+	}
+	fputs("],\"check\":", f);
+	results_json_string(f, r->check);
+	fputs("}\n", f);
+}
+
+RESULTS_API void results_write_csv(FILE* f, const bench_result* r, int header)
+{
+	int i;
+	if(header) {
+		fputs("timestamp,kernel,variant,size,threads,metric,value,unit,check\n", f);
+	}
+	for(i = 0; i < r->metric_count; ++i) {
+		fprintf(f, "%lld,", r->timestamp);
+		results_csv_string(f, r->kernel);
+		fputc(',', f);
+		results_csv_string(f, r->variant);
+		fputc(',', f);
+		results_csv_string(f, r->size);
+		fprintf(f, ",%d,", r->threads);
+		results_csv_string(f, r->metrics[i].name);
+		fprintf(f, ",%.17g,", r->metrics[i].value);
+		results_csv_string(f, r->metrics[i].unit);
+		fputc(',', f);
+		results_csv_string(f, r->check);
+		fputc('\n', f);
+	}
+}
+
+/* Returns 0 on success (or when no format was asked for), -1 if the
+ * results file could not be opened. */
+RESULTS_API int bench_result_emit(const bench_result* r)
+{
+	const int format = bench_result_format();
+	const char* path = getenv("BENCH_RESULTS");
+	FILE* f = stderr;
+	int header = 1;
+
+	if(format == BENCH_FORMAT_NONE) {
+		return 0;
+	}
+	if(r->metrics_dropped) {
+		fprintf(stderr, "results: out of memory, %d metrics dropped from the %s-%s record\n", r->metrics_dropped, r->kernel, r->variant);
+	}
+	if(path && *path) {
+		f = fopen(path, "a");
+		if(!f) {
+			fprintf(stderr, "results: cannot open %s\n", path);
+			return -1;
+		}
+		fseek(f, 0, SEEK_END);
+		header = ftell(f) == 0;
+	}
+	if(format == BENCH_FORMAT_JSON) {
+		results_write_json(f, r);
+	} else {
+		results_write_csv(f, r, header);
+	}
+	if(f != stderr) {
+		fclose(f);
+	} else {
+		fflush(f);
+	}
+	return 0;
+}
+
+#endif
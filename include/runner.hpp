@@ -0,0 +1,769 @@
+#ifndef RUNNER_HPP
+#define RUNNER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include "timer.hpp"
+#include "machine.hpp"
+#include "allocations.hpp"
+#include "verify.hpp"
+#include "profiler.hpp"
+#include "cpu_features.hpp"
+#include "buffers.h"
+#include "results.h"
+
+// A kernel hands its body to run_benchmark(), which runs it a number of
+// times untimed to warm up, then a number of times timed. If a minimum
+// sample time is set, the number of iterations of the body per sample is
+// calibrated first, doubling (or better) until one sample takes at least
+// that long, much like whetstone's calibrate loop.
+//
+// The settings come from the environment so that argv stays free for the
+// problem size:
+//
+//   BENCH_WARMUP       untimed runs before measuring               (0)
+//   BENCH_REPETITIONS  number of timed samples                     (1)
+//   BENCH_MIN_TIME     minimum sample length in ms, 0 = no calibration (0)
+//   BENCH_CONFIDENCE   level of the bootstrapped median interval   (0.95)
+//   BENCH_COUNTERS     1 = also sample the hardware counters       (0)
+//   BENCH_CPUS         CPUs to pin to, e.g. 2-5 or 0,2,4; OpenMP threads
+//                      get one each, see machine.hpp               (unpinned)
+//   BENCH_MAX_DRIFT    clock drift between samples, in percent, above which
+//                      the run is marked invalid; a single run is only
+//                      probed if this is set                       (5)
+//   BENCH_FORMAT       json or csv: also write a result record, see results.h
+//   BENCH_GOLDEN       golden output file to check the final run against,
+//                      see verify.hpp                              (none)
+//   BENCH_VERIFY       check, or record: write the final run's outputs to
+//                      the golden file instead of checking them    (check)
+//   BENCH_ULPS         units in the last place that a floating-point
+//                      result may be off by                        (0)
+//   BENCH_ISA          highest instruction set for kernels that choose
+//                      theirs at run time, see cpu_features.hpp    (best there is)
+//   BENCH_PROFILE      write a sampled CPU profile as folded stacks to this
+//                      file, see profiler.hpp                      (none)
+//   BENCH_PAGES        page backing of large buffers: transparent, huge,
+//                      small or heap, see buffers.h                (transparent)
+//   BENCH_NUMA         NUMA placement of large buffers: first-touch,
+//                      interleave or bind, see buffers.h           (the process's)
+//   BENCH_NUMA_NODE    NUMA node for bind                          (0)
+//
+// A kernel declares the files it writes with writes(), and with
+// floating_point_output() that its output is numbers compared with a
+// tolerance rather than byte for byte. A run whose output does not match
+// the golden file exits with status 1.
+//
+// The peak resident set size is always reported with the summary; builds
+// with BENCH_ALLOCATIONS defined also report allocations and the live-bytes
+// high-water mark of the timed runs (see allocations.hpp). Kernels whose
+// buffers come from bench_buffer_alloc() also report the pages they got.
+//
+// Only the very last run of the body writes to stdout; every other run is
+// pointed at the null device, so the output is the same as a single run.
+// With the defaults the body runs exactly once and the elapsed microseconds
+// are printed to stderr, which is what every kernel has always done.
+
+struct benchmark_options {
+	unsigned warmup;
+	unsigned repetitions;
+	double min_time; // milliseconds
+	double confidence;
+	unsigned resamples;
+	bool counters;
+	std::vector<int> cpus;
+	double max_drift; // percent
+	bool check_drift; // probe the clock even on a single run
+	// golden output verification
+	std::string golden;
+	bool record_golden;
+	double max_ulps;
+	std::vector<std::string> output_files;
+	bool floating_point;
+	// who is running: the program name (<kernel>-<variant>) and problem size
+	std::string program;
+	std::string size;
+
+	benchmark_options() : warmup(0), repetitions(1), min_time(0.0), confidence(0.95), resamples(1000), counters(false), max_drift(5.0), check_drift(false), record_golden(false), max_ulps(0.0), floating_point(false) {
+	}
+
+	static benchmark_options from_environment() {
+		benchmark_options options;
+		options.warmup      = static_cast<unsigned>(environment("BENCH_WARMUP", options.warmup));
+		options.repetitions = std::max(1u, static_cast<unsigned>(environment("BENCH_REPETITIONS", options.repetitions)));
+		options.min_time    = std::max(0.0, environment("BENCH_MIN_TIME", options.min_time));
+		options.confidence  = std::min(0.999, std::max(0.5, environment("BENCH_CONFIDENCE", options.confidence)));
+		options.counters    = environment("BENCH_COUNTERS", 0.0) != 0.0;
+		options.max_drift   = environment("BENCH_MAX_DRIFT", options.max_drift);
+		options.check_drift = environment("BENCH_MAX_DRIFT", -1.0) >= 0.0;
+		if(const char* cpus = std::getenv("BENCH_CPUS")) {
+			options.cpus = parse_cpu_list(cpus);
+		}
+		if(const char* golden = std::getenv("BENCH_GOLDEN")) {
+			options.golden = golden;
+		}
+		if(const char* verify = std::getenv("BENCH_VERIFY")) {
+			options.record_golden = std::string(verify) == "record";
+		}
+		options.max_ulps    = std::max(0.0, environment("BENCH_ULPS", options.max_ulps));
+		return options;
+	}
+
+	template<typename Size>
+	benchmark_options& identify(const char* program_name, const Size& problem_size) {
+		std::ostringstream os;
+		os << problem_size;
+		program = program_name ? program_name : "";
+		size = os.str();
+		return *this;
+	}
+
+	// a file the body writes, to be verified along with stdout
+	benchmark_options& writes(const char* file) {
+		output_files.push_back(file);
+		return *this;
+	}
+
+	// the output is floating-point results, which may be off by BENCH_ULPS
+	benchmark_options& floating_point_output() {
+		floating_point = true;
+		return *this;
+	}
+
+	bool verifying() const {
+		return !golden.empty();
+	}
+
+	// for kernels that consume their input (stdin) or keep global state that
+	// cannot be reset: whatever the environment says, run the body once.
+	benchmark_options& single_shot() {
+		if(warmup != 0 || repetitions != 1 || min_time != 0.0) {
+			std::cerr << "runner: this kernel cannot be repeated; running it once" << std::endl;
+		}
+		warmup = 0;
+		repetitions = 1;
+		min_time = 0.0;
+		return *this;
+	}
+
+	static double environment(const char* name, double default_value) {
+		const char* value = std::getenv(name);
+		return (value && *value) ? std::atof(value) : default_value;
+	}
+};
+
+// all times are microseconds per iteration of the body
+struct benchmark_statistics {
+	std::vector<double> samples;
+	unsigned long long iterations;
+	double min;
+	double max;
+	double median;
+	double mean;
+	double stddev;
+	double confidence;
+	double ci_low;
+	double ci_high;
+	// summed over every timed iteration, when counters were asked for
+	bool counted;
+	counter_sample counters;
+	const char* counters_reason;
+	// FNV-1a of the final run's stdout, when it was captured
+	unsigned long long output_digest;
+	unsigned long long output_bytes;
+	std::string output_text; // only kept when it is compared with a tolerance
+	// 1 the outputs matched the golden file, 0 they did not, -1 not checked
+	int verified;
+	std::vector<std::string> verify_messages;
+	// how quiet the machine was
+	machine_state machine;
+	double frequency_drift; // percent, between the probes around each sample, -1 if not probed
+	long long preemptions;  // involuntary context switches while timing, -1 if unknown
+	bool valid;
+	std::string invalid_reason;
+	// memory: allocation counts are totals over every timed iteration
+	long long peak_rss;        // bytes, -1 if unknown
+	bool allocations_tracked;
+	allocation_counts allocations;
+	long long peak_live_bytes; // high-water mark while timing
+
+	benchmark_statistics() : iterations(1), min(0.0), max(0.0), median(0.0), mean(0.0), stddev(0.0), confidence(0.0), ci_low(0.0), ci_high(0.0), counted(false), counters_reason(""), output_digest(0), output_bytes(0), verified(-1), frequency_drift(-1.0), preemptions(-1), valid(true), peak_rss(-1), allocations_tracked(false), peak_live_bytes(0) {
+		allocations.allocations = allocations.frees = allocations.bytes = 0;
+	}
+};
+
+namespace runner_detail {
+	inline double median_of(std::vector<double> values) {
+		if(values.empty()) {
+			return 0.0;
+		}
+		const size_t middle = values.size() / 2;
+		std::nth_element(values.begin(), values.begin() + middle, values.end());
+		double m = values[middle];
+		if(values.size() % 2 == 0) {
+			m = (m + *std::max_element(values.begin(), values.begin() + middle)) / 2.0;
+		}
+		return m;
+	}
+
+	// Percentile bootstrap of the median. The generator is seeded with a
+	// constant so that the same samples always give the same interval.
+	inline void bootstrap_median(const std::vector<double>& values, double confidence, unsigned resamples, double& low, double& high) {
+		if(values.size() < 2 || resamples == 0) {
+			low = high = median_of(values);
+			return;
+		}
+		std::mt19937 engine(5489u);
+		std::uniform_int_distribution<size_t> pick(0, values.size() - 1);
+		std::vector<double> medians(resamples);
+		std::vector<double> resample(values.size());
+		for(unsigned r = 0; r < resamples; ++r) {
+			for(size_t i = 0; i < resample.size(); ++i) {
+				resample[i] = values[pick(engine)];
+			}
+			medians[r] = median_of(resample);
+		}
+		std::sort(medians.begin(), medians.end());
+		const double tail = (1.0 - confidence) / 2.0;
+		low  = medians[static_cast<size_t>(tail * (resamples - 1))];
+		high = medians[static_cast<size_t>((1.0 - tail) * (resamples - 1))];
+	}
+
+	// Points fd 1 somewhere else: at the null device for runs whose output
+	// nobody wants, or at a temporary file for the run whose output has to be
+	// looked at. restore() puts the original back and replays anything
+	// captured onto it, hashing it on the way through. Both stdio and
+	// iostreams are flushed at every switch so that nothing buffered leaks
+	// into the wrong destination.
+	struct stdout_redirect {
+		stdout_redirect() : saved(-1), captured(0), digest(14695981039346656037ull), bytes(0), keeping(false) {
+		}
+
+		~stdout_redirect() {
+			restore();
+		}
+
+		void discard() {
+#ifdef _WIN32
+			int null_fd = ::_open("NUL", _O_WRONLY);
+#else
+			int null_fd = ::open("/dev/null", O_WRONLY);
+#endif
+			if(null_fd != -1) {
+				point_at(null_fd);
+				close_fd(null_fd);
+			}
+		}
+
+		void capture() {
+			if(!captured) {
+				captured = std::tmpfile();
+			}
+			if(captured) {
+#ifdef _WIN32
+				point_at(::_fileno(captured));
+#else
+				point_at(::fileno(captured));
+#endif
+			}
+		}
+
+		void restore() {
+			if(saved == -1) {
+				return;
+			}
+			flush();
+#ifdef _WIN32
+			::_dup2(saved, 1);
+#else
+			::dup2(saved, 1);
+#endif
+			close_fd(saved);
+			saved = -1;
+			if(captured) {
+				replay();
+			}
+		}
+
+		// also keep a copy of what was captured, for outputs that are small
+		// enough and need more than a digest
+		void keep_text() {
+			keeping = true;
+		}
+
+		const std::string& text() const {
+			return kept;
+		}
+
+		// FNV-1a over everything captured
+		unsigned long long output_digest() const {
+			return digest;
+		}
+
+		unsigned long long output_bytes() const {
+			return bytes;
+		}
+
+	private:
+		stdout_redirect(const stdout_redirect&);
+		stdout_redirect& operator=(const stdout_redirect&);
+
+		static void flush() {
+			std::cout.flush();
+			std::fflush(stdout);
+		}
+
+		static void close_fd(int fd) {
+#ifdef _WIN32
+			::_close(fd);
+#else
+			::close(fd);
+#endif
+		}
+
+		void point_at(int fd) {
+			flush();
+#ifdef _WIN32
+			if(saved == -1) {
+				saved = ::_dup(1);
+			}
+			::_dup2(fd, 1);
+#else
+			if(saved == -1) {
+				saved = ::dup(1);
+			}
+			::dup2(fd, 1);
+#endif
+		}
+
+		void replay() {
+			std::rewind(captured);
+			char buffer[65536];
+			size_t n;
+			while((n = std::fread(buffer, 1, sizeof(buffer), captured)) != 0) {
+				for(size_t i = 0; i < n; ++i) {
+					digest = (digest ^ static_cast<unsigned char>(buffer[i])) * 1099511628211ull;
+				}
+				bytes += n;
+				if(keeping) {
+					kept.append(buffer, n);
+				}
+				std::fwrite(buffer, 1, n, stdout);
+			}
+			std::fflush(stdout);
+			std::fclose(captured);
+			captured = 0;
+		}
+
+		int saved;
+		std::FILE* captured;
+		unsigned long long digest;
+		unsigned long long bytes;
+		bool keeping;
+		std::string kept;
+	};
+
+	template<typename F>
+	double time_iterations(F& body, unsigned long long iterations) {
+		high_resolution_timer timer;
+		for(unsigned long long i = 0; i < iterations; ++i) {
+			body();
+		}
+		return std::chrono::duration_cast<std::chrono::duration<double, std::micro> >(timer.pulse()).count();
+	}
+
+	// one timed sample; stdout comes back (or is captured) for the final
+	// run of the final sample
+	template<typename F>
+	void run_iterations(F& body, unsigned long long iterations, bool last, bool capture, stdout_redirect& redirect) {
+		for(unsigned long long i = 0; i < iterations; ++i) {
+			if(last && i + 1 == iterations) {
+				if(capture) {
+					redirect.capture();
+				} else {
+					redirect.restore();
+				}
+			}
+			body();
+		}
+	}
+}
+
+inline benchmark_statistics summarize(const std::vector<double>& samples, unsigned long long iterations, const benchmark_options& options) {
+	benchmark_statistics stats;
+	stats.samples = samples;
+	stats.iterations = iterations;
+	stats.confidence = options.confidence;
+	if(samples.empty()) {
+		return stats;
+	}
+	stats.min = *std::min_element(samples.begin(), samples.end());
+	stats.max = *std::max_element(samples.begin(), samples.end());
+	stats.median = runner_detail::median_of(samples);
+	double sum = 0.0;
+	for(size_t i = 0; i < samples.size(); ++i) {
+		sum += samples[i];
+	}
+	stats.mean = sum / samples.size();
+	double squares = 0.0;
+	for(size_t i = 0; i < samples.size(); ++i) {
+		squares += (samples[i] - stats.mean) * (samples[i] - stats.mean);
+	}
+	stats.stddev = samples.size() > 1 ? std::sqrt(squares / (samples.size() - 1)) : 0.0;
+	runner_detail::bootstrap_median(samples, options.confidence, options.resamples, stats.ci_low, stats.ci_high);
+	return stats;
+}
+
+// Runs the body as the options direct and returns the timings without
+// printing anything. The body must leave no state behind that changes the
+// work done by the next call.
+template<typename F>
+benchmark_statistics measure(F body, const benchmark_options& options) {
+	const bool repeated = options.warmup != 0 || options.repetitions != 1 || options.min_time != 0.0;
+	// the probes take a few milliseconds each, which a plain single run
+	// should not pay for
+	const bool probing = repeated || options.check_drift;
+	// pin first, so that every thread started from here on (OpenMP's, the
+	// counters' inherited ones) stays inside the set
+	std::vector<int> pinned;
+	if(!options.cpus.empty()) {
+		std::string error;
+		if(pin_to_cpus(options.cpus, error)) {
+			pinned = options.cpus;
+		} else {
+			std::cerr << "runner: cannot pin to BENCH_CPUS: " << error << std::endl;
+		}
+	}
+	// counters are only inherited by threads created after they are opened,
+	// so open them before the body has had a chance to start a thread pool
+	std::unique_ptr<high_resolution_counting_timer> counting(options.counters ? new high_resolution_counting_timer : nullptr);
+	// the final output is captured whenever something downstream needs to see it
+	const bool capture = bench_result_format() != BENCH_FORMAT_NONE || options.verifying();
+	runner_detail::stdout_redirect redirect;
+	if(options.verifying() && options.floating_point) {
+		redirect.keep_text();
+	}
+	if(repeated) {
+		redirect.discard();
+	}
+
+	for(unsigned i = 0; i < options.warmup; ++i) {
+		body();
+	}
+
+	unsigned long long iterations = 1;
+	if(options.min_time > 0.0) {
+		const double target = options.min_time * 1000.0;
+		for(;;) {
+			const double elapsed = runner_detail::time_iterations(body, iterations);
+			if(elapsed >= target) {
+				break;
+			}
+			const double scale = elapsed > 0.0 ? 1.2 * target / elapsed : 10.0;
+			iterations = static_cast<unsigned long long>(iterations * std::min(10.0, std::max(2.0, scale)));
+		}
+	}
+
+	std::vector<double> samples;
+	samples.reserve(options.repetitions);
+	counter_sample counters;
+	std::vector<double> probes;
+	if(probing) {
+		probes.push_back(frequency_probe());
+	}
+	const long long switches = involuntary_switches();
+	const allocation_counts allocated = process_allocations();
+	reset_peak_live_bytes();
+	for(unsigned r = 0; r < options.repetitions; ++r) {
+		const bool last = r + 1 == options.repetitions;
+		double elapsed = 0.0;
+		if(counting) {
+			counting->pulse();
+			runner_detail::run_iterations(body, iterations, last, capture, redirect);
+			elapsed = std::chrono::duration_cast<std::chrono::duration<double, std::micro> >(counting->pulse()).count();
+			counters += counting->sample();
+		} else {
+			high_resolution_timer timer;
+			runner_detail::run_iterations(body, iterations, last, capture, redirect);
+			elapsed = std::chrono::duration_cast<std::chrono::duration<double, std::micro> >(timer.pulse()).count();
+		}
+		samples.push_back(elapsed / iterations);
+		if(probing) {
+			probes.push_back(frequency_probe());
+		}
+	}
+	const long long switched = involuntary_switches();
+	const allocation_counts allocated_after = process_allocations();
+	const long long peak_live = peak_live_bytes();
+	redirect.restore();
+	benchmark_statistics stats = summarize(samples, iterations, options);
+	stats.machine = inspect_machine(pinned);
+	if(probing) {
+		stats.frequency_drift = frequency_drift(probes);
+	}
+	stats.preemptions = switches >= 0 && switched >= 0 ? switched - switches : -1;
+	stats.peak_rss = results_peak_rss();
+	stats.allocations_tracked = allocations_tracked();
+	stats.allocations.allocations = allocated_after.allocations - allocated.allocations;
+	stats.allocations.frees = allocated_after.frees - allocated.frees;
+	stats.allocations.bytes = allocated_after.bytes - allocated.bytes;
+	stats.peak_live_bytes = peak_live;
+	if(stats.frequency_drift > options.max_drift) {
+		std::ostringstream reason;
+		reason << std::fixed << std::setprecision(1) << "clock drifted " << stats.frequency_drift << "% between samples";
+		reason.unsetf(std::ios_base::floatfield);
+		reason << " (BENCH_MAX_DRIFT " << options.max_drift << "%)";
+		stats.valid = false;
+		stats.invalid_reason = reason.str();
+	}
+	if(capture) {
+		stats.output_digest = redirect.output_digest();
+		stats.output_bytes = redirect.output_bytes();
+		stats.output_text = redirect.text();
+	}
+	if(counting) {
+		stats.counted = true;
+		stats.counters = counters;
+		stats.counters_reason = counting->reason();
+	}
+	return stats;
+}
+
+// Checks the final run's stdout and files against the golden file, or
+// records them there, as BENCH_VERIFY says. The outputs are keyed by kernel
+// rather than program, so every variant is held to the same answers.
+inline void verify_outputs(benchmark_statistics& stats, const benchmark_options& options) {
+	if(!options.verifying()) {
+		return;
+	}
+	bench_result identity;
+	bench_result_init_from_program(&identity, options.program.c_str(), options.size.c_str());
+	std::vector<golden_entry> outputs;
+	outputs.push_back(options.floating_point ? tolerant_output("stdout", stats.output_text)
+	                                         : exact_output("stdout", stats.output_digest, stats.output_bytes));
+	for(size_t i = 0; i < options.output_files.size(); ++i) {
+		bool found = false;
+		outputs.push_back(file_output(options.output_files[i], options.floating_point, found));
+		if(!found) {
+			stats.verify_messages.push_back(options.output_files[i] + " was not written");
+		}
+	}
+	for(size_t i = 0; i < outputs.size(); ++i) {
+		outputs[i].kernel = identity.kernel;
+		outputs[i].size = options.size.empty() ? "-" : options.size;
+	}
+	if(!stats.verify_messages.empty()) {
+		stats.verified = 0;
+		return;
+	}
+
+	if(options.record_golden) {
+		if(write_golden(options.golden, outputs)) {
+			std::ostringstream os;
+			os << "recorded " << outputs.size() << " output" << (outputs.size() == 1 ? "" : "s") << " in " << options.golden;
+			stats.verify_messages.push_back(os.str());
+		} else {
+			stats.verify_messages.push_back("cannot write " + options.golden);
+			stats.verified = 0;
+		}
+		return;
+	}
+
+	const std::vector<golden_entry> golden = read_golden(options.golden);
+	stats.verified = 1;
+	for(size_t i = 0; i < outputs.size(); ++i) {
+		const golden_entry* expected = 0;
+		for(size_t j = 0; j < golden.size() && !expected; ++j) {
+			if(golden[j].key() == outputs[i].key()) {
+				expected = &golden[j];
+			}
+		}
+		std::string why;
+		if(!expected) {
+			why = "no golden entry in " + options.golden + " (record one with BENCH_VERIFY=record)";
+		} else if(matches_golden(*expected, outputs[i], options.max_ulps, why)) {
+			continue;
+		}
+		stats.verified = 0;
+		stats.verify_messages.push_back(outputs[i].key() + ": " + why);
+	}
+	if(stats.verified == 1) {
+		std::ostringstream os;
+		os << outputs.size() << " output" << (outputs.size() == 1 ? "" : "s") << " match " << options.golden;
+		stats.verify_messages.push_back(os.str());
+	}
+}
+
+inline void report_counters(const benchmark_statistics& stats, std::ostream& os) {
+	if(*stats.counters_reason) {
+		os << "counters: unavailable, " << stats.counters_reason << std::endl;
+		return;
+	}
+	const double runs = static_cast<double>(stats.samples.size()) * stats.iterations;
+	const counter_sample& c = stats.counters;
+	if(c.valid[counter_sample::cycles] && c.valid[counter_sample::instructions]) {
+		os << "ipc:     " << std::setprecision(2) << c.ipc() << "\n";
+	}
+	os.precision(0);
+	for(int i = 0; i < counter_sample::counter_count; ++i) {
+		if(c.valid[i]) {
+			os << counter_sample::name(i) << ": " << c.values[i] / runs << " per run\n";
+		}
+	}
+	os.flush();
+}
+
+inline void report_memory(const benchmark_statistics& stats, std::ostream& os) {
+	if(stats.peak_rss >= 0) {
+		os << "peak rss: " << stats.peak_rss / 1024 << " KiB\n";
+	}
+	if(stats.allocations_tracked) {
+		const double runs = static_cast<double>(stats.samples.size()) * stats.iterations;
+		os.precision(0);
+		os << "allocs:  " << stats.allocations.allocations / runs << " per run, "
+		   << stats.allocations.bytes / runs << " bytes per run, peak live "
+		   << stats.peak_live_bytes << " bytes\n";
+	}
+	char lines[BENCH_BUFFER_LINES][256];
+	const int count = bench_buffer_lines(lines, BENCH_BUFFER_LINES);
+	for(int i = 0; i < count; ++i) {
+		os << "buffers: " << lines[i] << "\n";
+	}
+	os.flush();
+}
+
+// A single run reports the bare microsecond count; repeated runs put the
+// median first, so the first line is still one integer, then the summary.
+inline void report(const benchmark_statistics& stats, std::ostream& os = std::cerr) {
+	os << static_cast<long long>(stats.median) << std::endl;
+	if(!stats.valid) {
+		os << "INVALID: " << stats.invalid_reason << std::endl;
+	}
+	for(size_t i = 0; i < stats.verify_messages.size(); ++i) {
+		os << (stats.verified == 0 ? "MISMATCH: " : "verify:  ") << stats.verify_messages[i] << std::endl;
+	}
+	if(stats.samples.size() < 2 && stats.iterations == 1 && !stats.counted && stats.machine.cpus.empty() && !stats.allocations_tracked && !bench_buffer_mapped()) {
+		return;
+	}
+	std::ios_base::fmtflags flags = os.flags();
+	std::streamsize precision = os.precision();
+	os.setf(std::ios_base::fixed, std::ios_base::floatfield);
+	os.precision(1);
+	os << "samples: " << stats.samples.size() << " x " << stats.iterations << " iterations\n"
+	   << "min:     " << stats.min    << " us\n"
+	   << "median:  " << stats.median << " us\n"
+	   << "mean:    " << stats.mean   << " us\n"
+	   << "max:     " << stats.max    << " us\n"
+	   << "stddev:  " << stats.stddev << " us\n"
+	   << static_cast<int>(stats.confidence * 100.0 + 0.5) << "% CI:  [" << stats.ci_low << ", " << stats.ci_high << "] us (median, bootstrap)" << std::endl;
+	if(stats.frequency_drift >= 0.0) {
+		os << "drift:   " << stats.frequency_drift << "% between samples\n";
+	}
+	if(stats.preemptions >= 0) {
+		os << "preempted: " << stats.preemptions << " times\n";
+	}
+	report_machine(stats.machine, os);
+	for(size_t i = 0; i < isa_choices().size(); ++i) {
+		os << "isa:     " << isa_choices()[i].first << " " << isa_name(isa_choices()[i].second) << "\n";
+	}
+	report_memory(stats, os);
+	if(stats.counted) {
+		report_counters(stats, os);
+	}
+	os.flags(flags);
+	os.precision(precision);
+}
+
+// One structured record per run (see results.h), when BENCH_FORMAT asks for it.
+inline void emit_result(const benchmark_statistics& stats, const benchmark_options& options) {
+	if(bench_result_format() == BENCH_FORMAT_NONE) {
+		return;
+	}
+	bench_result r;
+	bench_result_init_from_program(&r, options.program.c_str(), options.size.c_str());
+	bench_result_metric(&r, "median", stats.median, "us");
+	bench_result_metric(&r, "min", stats.min, "us");
+	bench_result_metric(&r, "mean", stats.mean, "us");
+	bench_result_metric(&r, "max", stats.max, "us");
+	bench_result_metric(&r, "stddev", stats.stddev, "us");
+	bench_result_metric(&r, "ci_low", stats.ci_low, "us");
+	bench_result_metric(&r, "ci_high", stats.ci_high, "us");
+	bench_result_metric(&r, "samples", static_cast<double>(stats.samples.size()), "");
+	bench_result_metric(&r, "iterations", static_cast<double>(stats.iterations), "");
+	if(stats.frequency_drift >= 0.0) {
+		bench_result_metric(&r, "frequency_drift", stats.frequency_drift, "%");
+	}
+	if(stats.preemptions >= 0) {
+		bench_result_metric(&r, "preemptions", static_cast<double>(stats.preemptions), "");
+	}
+	if(stats.machine.turbo >= 0) {
+		bench_result_metric(&r, "turbo", stats.machine.turbo, "");
+	}
+	if(stats.machine.smt >= 0) {
+		bench_result_metric(&r, "smt", stats.machine.smt, "");
+	}
+	bench_result_metric(&r, "valid", stats.valid ? 1.0 : 0.0, "");
+	if(stats.verified >= 0) {
+		bench_result_metric(&r, "verified", stats.verified, "");
+	}
+	bench_result_peak_rss(&r);
+	bench_result_buffers(&r);
+	for(size_t i = 0; i < isa_choices().size(); ++i) {
+		// 0 scalar, 1 sse, 2 avx2, 3 avx512
+		bench_result_metric(&r, "isa_level", isa_choices()[i].second, "");
+	}
+	if(stats.allocations_tracked) {
+		const double runs = static_cast<double>(stats.samples.size()) * stats.iterations;
+		bench_result_metric(&r, "allocations", stats.allocations.allocations / runs, "");
+		bench_result_metric(&r, "allocated_bytes", stats.allocations.bytes / runs, "bytes");
+		bench_result_metric(&r, "peak_live_bytes", static_cast<double>(stats.peak_live_bytes), "bytes");
+	}
+	for(size_t i = 0; i < stats.samples.size(); ++i) {
+		bench_result_metric(&r, "sample", stats.samples[i], "us");
+	}
+	if(stats.counted) {
+		const double runs = static_cast<double>(stats.samples.size()) * stats.iterations;
+		for(int i = 0; i < counter_sample::counter_count; ++i) {
+			if(stats.counters.valid[i]) {
+				bench_result_metric(&r, counter_sample::name(i), stats.counters.values[i] / runs, "events");
+			}
+		}
+		if(stats.counters.ipc() != 0.0) {
+			bench_result_metric(&r, "ipc", stats.counters.ipc(), "");
+		}
+	}
+	char check[64];
+	std::sprintf(check, "fnv1a64:%016llx/%llu", stats.output_digest, stats.output_bytes);
+	bench_result_check(&r, check);
+	bench_result_emit(&r);
+	bench_result_free(&r);
+}
+
+template<typename F>
+int run_benchmark(F body, const benchmark_options& options = benchmark_options::from_environment()) {
+	benchmark_statistics stats = measure(body, options);
+	verify_outputs(stats, options);
+	report(stats);
+	emit_result(stats, options);
+	return stats.verified == 0 ? 1 : 0;
+}
+
+#endif
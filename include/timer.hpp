@@ -11,8 +11,29 @@
 #include <sys/time.h>
 #endif
 
+#if (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)) && !defined(EMSCRIPTEN)
+#define TIMER_TSC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#endif
+
+#if defined(__linux__) && !defined(EMSCRIPTEN)
+#define TIMER_PERF_EVENTS 1
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
 template<typename clock_t>
 struct timer {
+	typedef clock_t clock_type;
 	typedef typename clock_t::time_point time_point;
 	typedef typename clock_t::duration duration;
 
@@ -94,4 +115,367 @@ typedef timer<std::chrono::high_resolution_clock> high_resolution_timer;
 
 #endif
 
+#ifdef TIMER_TSC
+
+// The time-stamp counter, read with rdtscp. A reading costs a few
+// nanoseconds, against a vDSO call (or a system call) for the other clocks,
+// which makes it cheap enough to time single iterations of an inner loop.
+// rdtscp waits for the instructions before it to finish; ones after it may
+// start early, which is below the resolution anyone should rely on anyway.
+//
+// The counter is only a clock if it is invariant, i.e. ticks at a constant
+// rate whatever the P- and C-states (CPUID 0x80000007, EDX bit 8). The rate
+// is calibrated against steady_clock on first use, which takes about 10ms.
+// Without rdtscp or an invariant counter, now() and ticks() quietly fall back to
+// steady_clock: still correct, just not cheap; usable() says which it is.
+struct tsc_clock {
+	typedef std::chrono::nanoseconds duration;
+	typedef duration::rep rep;
+	typedef duration::period period;
+	typedef std::chrono::time_point<tsc_clock> time_point;
+	static const bool is_monotonic = true;
+	static const bool is_steady = true;
+
+	static time_point now() {
+		const tsc_calibration& c = calibration();
+		if(!c.usable) {
+			return time_point(std::chrono::duration_cast<duration>(std::chrono::steady_clock::now() - c.steady_base));
+		}
+		return time_point(duration(static_cast<rep>(static_cast<double>(read_counter() - c.tick_base) * c.nanoseconds_per_tick)));
+	}
+
+	// the raw counter, for callers that convert later with to_duration(); when
+	// the counter is not usable these are steady_clock nanoseconds instead
+	static unsigned long long ticks() {
+		const tsc_calibration& c = calibration();
+		if(!c.usable) {
+			return static_cast<unsigned long long>(std::chrono::duration_cast<duration>(std::chrono::steady_clock::now() - c.steady_base).count());
+		}
+		return read_counter();
+	}
+
+	static duration to_duration(unsigned long long tick_count) {
+		const tsc_calibration& c = calibration();
+		if(!c.usable) {
+			return duration(static_cast<rep>(tick_count));
+		}
+		return duration(static_cast<rep>(static_cast<double>(tick_count) * c.nanoseconds_per_tick));
+	}
+
+	static bool usable() {
+		return calibration().usable;
+	}
+
+	static bool invariant() {
+		return calibration().invariant;
+	}
+
+	static double ticks_per_second() {
+		return calibration().usable ? 1.0e9 / calibration().nanoseconds_per_tick : 0.0;
+	}
+
+private:
+	// only safe to call once calibration has found rdtscp
+	static unsigned long long read_counter() {
+		unsigned int processor;
+		return __rdtscp(&processor);
+	}
+
+	struct tsc_calibration {
+		tsc_calibration() : usable(false), invariant(false), nanoseconds_per_tick(0.0), tick_base(0), steady_base(std::chrono::steady_clock::now()) {
+			unsigned int max_extended = 0, edx = 0, unused = 0;
+			bool has_rdtscp = false;
+			cpuid(0x80000000u, max_extended, unused);
+			if(max_extended >= 0x80000001u) {
+				cpuid(0x80000001u, unused, edx);
+				has_rdtscp = (edx & (1u << 27)) != 0;
+			}
+			if(max_extended >= 0x80000007u) {
+				cpuid(0x80000007u, unused, edx);
+				invariant = (edx & (1u << 8)) != 0;
+			}
+			if(!has_rdtscp || !invariant) {
+				return;
+			}
+
+			// bracket each counter reading with two clock readings and take the
+			// midpoint, so that the clock's own cost mostly cancels out
+			std::chrono::steady_clock::time_point start, end;
+			unsigned long long start_ticks = 0, end_ticks = 0;
+			read_pair(start, start_ticks);
+			do {
+				read_pair(end, end_ticks);
+			} while(end - start < std::chrono::milliseconds(10));
+			const double elapsed = std::chrono::duration_cast<std::chrono::duration<double, std::nano> >(end - start).count();
+			if(end_ticks <= start_ticks) {
+				return;
+			}
+			nanoseconds_per_tick = elapsed / static_cast<double>(end_ticks - start_ticks);
+			tick_base = end_ticks;
+			usable = true;
+		}
+
+		// eax of the leaf in a, edx in d
+		static void cpuid(unsigned int leaf, unsigned int& a, unsigned int& d) {
+#ifdef _MSC_VER
+			int registers[4];
+			__cpuid(registers, static_cast<int>(leaf));
+			a = static_cast<unsigned int>(registers[0]);
+			d = static_cast<unsigned int>(registers[3]);
+#else
+			unsigned int b, c;
+			__cpuid(leaf, a, b, c, d);
+#endif
+		}
+
+		static void read_pair(std::chrono::steady_clock::time_point& t, unsigned long long& tick_count) {
+			const std::chrono::steady_clock::time_point before = std::chrono::steady_clock::now();
+			tick_count = read_counter();
+			const std::chrono::steady_clock::time_point after = std::chrono::steady_clock::now();
+			t = before + (after - before) / 2;
+		}
+
+		bool usable;
+		bool invariant;
+		double nanoseconds_per_tick;
+		unsigned long long tick_base;
+		std::chrono::steady_clock::time_point steady_base;
+	};
+
+	static const tsc_calibration& calibration() {
+		static tsc_calibration c;
+		return c;
+	}
+};
+
+typedef timer<tsc_clock> tsc_timer;
+// the cheapest clock to read on this platform, for timing inner loops
+typedef tsc_timer fine_grained_timer;
+
+#else
+
+typedef high_resolution_timer fine_grained_timer;
+
+#endif
+
+// Hardware event counts for one measured region. A counter the machine
+// could not provide is marked invalid rather than reported as zero.
+struct counter_sample {
+	enum counter {
+		cycles,
+		instructions,
+		llc_misses,
+		branch_misses,
+		dtlb_misses,
+		counter_count
+	};
+
+	unsigned long long values[counter_count];
+	bool valid[counter_count];
+
+	counter_sample() {
+		for(int i = 0; i < counter_count; ++i) {
+			values[i] = 0;
+			valid[i] = false;
+		}
+	}
+
+	double ipc() const {
+		return (valid[cycles] && valid[instructions] && values[cycles] != 0) ? static_cast<double>(values[instructions]) / values[cycles] : 0.0;
+	}
+
+	counter_sample& operator+=(const counter_sample& rhs) {
+		for(int i = 0; i < counter_count; ++i) {
+			values[i] += rhs.values[i];
+			valid[i] = valid[i] || rhs.valid[i];
+		}
+		return *this;
+	}
+
+	static const char* name(int c) {
+		static const char* const names[counter_count] = { "cycles", "instructions", "llc-misses", "branch-misses", "dtlb-misses" };
+		return names[c];
+	}
+};
+
+// A set of free-running user-space hardware counters, opened with
+// perf_event_open on Linux. Each counter is opened on its own so that one
+// the PMU lacks (dTLB events are often missing under virtualization) does
+// not take the others down with it. Counters are inherited by threads
+// created after construction, so OpenMP workers are included as long as the
+// counters exist before the first parallel region.
+//
+// If perf events are not permitted (perf_event_paranoid, seccomp, no PMU)
+// or the platform has none, available() is false, sample() returns a
+// sample with nothing valid, and reason() says why.
+struct perf_counters {
+	perf_counters() : error(0) {
+		for(int i = 0; i < counter_sample::counter_count; ++i) {
+			fds[i] = -1;
+			last[i] = reading();
+		}
+#ifdef TIMER_PERF_EVENTS
+		static const struct { unsigned int type; unsigned long long config; } events[counter_sample::counter_count] = {
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+			{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+			{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) }
+		};
+		for(int i = 0; i < counter_sample::counter_count; ++i) {
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = events[i].type;
+			attr.config = events[i].config;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.inherit = 1;
+			fds[i] = static_cast<int>(::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+			if(fds[i] == -1 && error == 0) {
+				error = errno;
+			}
+		}
+		for(int i = 0; i < counter_sample::counter_count; ++i) {
+			last[i] = read_counter(i);
+		}
+#else
+		error = -1;
+#endif
+	}
+
+	~perf_counters() {
+#ifdef TIMER_PERF_EVENTS
+		for(int i = 0; i < counter_sample::counter_count; ++i) {
+			if(fds[i] != -1) {
+				::close(fds[i]);
+			}
+		}
+#endif
+	}
+
+	bool available() const {
+		for(int i = 0; i < counter_sample::counter_count; ++i) {
+			if(fds[i] != -1) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	const char* reason() const {
+		if(available()) {
+			return "";
+		}
+#ifdef TIMER_PERF_EVENTS
+		switch(error) {
+		case EACCES:
+		case EPERM:
+			return "perf events not permitted (see /proc/sys/kernel/perf_event_paranoid)";
+		case ENOENT:
+		case EOPNOTSUPP:
+			return "no hardware counters on this machine";
+		case ENOSYS:
+			return "perf_event_open not supported by this kernel";
+		default:
+			return std::strerror(error);
+		}
+#else
+		return "hardware counters are only supported on Linux";
+#endif
+	}
+
+	// counts since the previous call (or since construction). Counts are
+	// scaled up when the kernel had to multiplex the counters.
+	counter_sample sample() {
+		counter_sample result;
+		for(int i = 0; i < counter_sample::counter_count; ++i) {
+			if(fds[i] == -1) {
+				continue;
+			}
+			reading now = read_counter(i);
+			const unsigned long long value   = now.value   - last[i].value;
+			const unsigned long long enabled = now.enabled - last[i].enabled;
+			const unsigned long long running = now.running - last[i].running;
+			last[i] = now;
+			if(running == 0) {
+				continue;
+			}
+			result.values[i] = running == enabled ? value : static_cast<unsigned long long>(static_cast<double>(value) * enabled / running);
+			result.valid[i] = true;
+		}
+		return result;
+	}
+
+private:
+	perf_counters(const perf_counters&);
+	perf_counters& operator=(const perf_counters&);
+
+	struct reading {
+		unsigned long long value;
+		unsigned long long enabled;
+		unsigned long long running;
+
+		reading() : value(0), enabled(0), running(0) {
+		}
+	};
+
+	reading read_counter(int i) {
+		reading r;
+#ifdef TIMER_PERF_EVENTS
+		if(fds[i] != -1) {
+			unsigned long long buffer[3] = {0};
+			if(::read(fds[i], buffer, sizeof(buffer)) == sizeof(buffer)) {
+				r.value = buffer[0];
+				r.enabled = buffer[1];
+				r.running = buffer[2];
+			}
+		}
+#else
+		(void)i;
+#endif
+		return r;
+	}
+
+	int fds[counter_sample::counter_count];
+	reading last[counter_sample::counter_count];
+	int error;
+};
+
+// A timer that samples the hardware counters whenever it pulses, so that
+// the counts cover exactly the region the duration does.
+template<typename clock_t>
+struct counting_timer {
+	typedef typename timer<clock_t>::time_point time_point;
+	typedef typename timer<clock_t>::duration duration;
+
+	counting_timer() : counters(), clock() {
+	}
+
+	duration pulse() {
+		last_sample = counters.sample();
+		return clock.pulse();
+	}
+
+	const counter_sample& sample() const {
+		return last_sample;
+	}
+
+	bool available() const {
+		return counters.available();
+	}
+
+	const char* reason() const {
+		return counters.reason();
+	}
+
+private:
+	perf_counters counters;
+	timer<clock_t> clock;
+	counter_sample last_sample;
+};
+
+typedef counting_timer<high_resolution_timer::clock_type> high_resolution_counting_timer;
+
 #endif
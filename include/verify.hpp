@@ -0,0 +1,277 @@
+#ifndef VERIFY_HPP
+#define VERIFY_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Golden outputs: what each kernel prints (or writes to a file) for a given
+// problem size, so that a variant that got faster by getting the answer
+// wrong is caught. The golden file holds one line per kernel, size and
+// output, shared by every variant of the kernel:
+//
+//   <kernel> <size> <output> exact fnv1a64:<digest>/<bytes>
+//   <kernel> <size> <output> ulp   fnv1a64:<digest>/<bytes> <number>...
+//
+// where <output> is "stdout" or the name of the file the kernel writes.
+// "exact" outputs have to match byte for byte. Kernels whose output is
+// floating-point results get "ulp" lines instead: the digest covers the
+// text with every number replaced by '#', and the numbers are compared one
+// by one, allowing a difference of a number of units in the last place.
+// A unit is the larger of the double's own and the last digit printed, so
+// for "%.9f" output one unit is 1e-9. Lines starting with '#' are comments.
+
+struct golden_entry {
+	std::string kernel;
+	std::string size;
+	std::string output;
+	bool tolerant;
+	std::string digest; // fnv1a64:<hex>/<bytes>
+	std::vector<std::string> numbers;
+
+	golden_entry() : tolerant(false) {
+	}
+
+	std::string key() const {
+		return kernel + " " + size + " " + output;
+	}
+};
+
+namespace verify_detail {
+	inline std::string format_digest(unsigned long long digest, unsigned long long bytes) {
+		char text[64];
+		std::sprintf(text, "fnv1a64:%016llx/%llu", digest, bytes);
+		return text;
+	}
+
+	inline bool is_digit(char c) {
+		return c >= '0' && c <= '9';
+	}
+
+	// length of the number starting at text[i], 0 if there is none; a digit
+	// run glued to a word ("x86", "Pfannkuchen9") is not a number
+	inline size_t number_at(const std::string& text, size_t i) {
+		if(i > 0) {
+			const char before = text[i - 1];
+			if(is_digit(before) || before == '.' || before == '_' || ((before | 0x20) >= 'a' && (before | 0x20) <= 'z')) {
+				return 0;
+			}
+		}
+		size_t j = i;
+		if(j < text.size() && (text[j] == '-' || text[j] == '+')) {
+			++j;
+		}
+		const size_t digits = j;
+		while(j < text.size() && is_digit(text[j])) {
+			++j;
+		}
+		if(j < text.size() && text[j] == '.') {
+			++j;
+			while(j < text.size() && is_digit(text[j])) {
+				++j;
+			}
+		}
+		// nothing but a sign, or a lone point
+		if(j == digits || (j == digits + 1 && !is_digit(text[digits]))) {
+			return 0;
+		}
+		if(j < text.size() && (text[j] == 'e' || text[j] == 'E')) {
+			size_t k = j + 1;
+			if(k < text.size() && (text[k] == '-' || text[k] == '+')) {
+				++k;
+			}
+			if(k < text.size() && is_digit(text[k])) {
+				while(k < text.size() && is_digit(text[k])) {
+					++k;
+				}
+				j = k;
+			}
+		}
+		return j - i;
+	}
+
+	// splits text into its numbers and the FNV-1a digest of what is left
+	// with each of them replaced by '#'
+	inline std::string split_numbers(const std::string& text, std::vector<std::string>& numbers) {
+		unsigned long long digest = 14695981039346656037ull;
+		unsigned long long bytes = 0;
+		for(size_t i = 0; i < text.size(); ) {
+			const size_t length = number_at(text, i);
+			char c = text[i];
+			if(length != 0) {
+				numbers.push_back(text.substr(i, length));
+				c = '#';
+				i += length;
+			} else {
+				++i;
+			}
+			digest = (digest ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+			++bytes;
+		}
+		return format_digest(digest, bytes);
+	}
+
+	// the value of the last digit printed: 1e-9 for "0.169075164", 1e-6 for
+	// "1.5e-5"
+	inline double printed_unit(const std::string& number) {
+		int decimals = 0;
+		const std::string::size_type point = number.find('.');
+		const std::string::size_type exponent = number.find_first_of("eE");
+		if(point != std::string::npos) {
+			decimals = static_cast<int>((exponent == std::string::npos ? number.size() : exponent) - point - 1);
+		}
+		const int scale = exponent == std::string::npos ? 0 : std::atoi(number.c_str() + exponent + 1);
+		return std::pow(10.0, scale - decimals);
+	}
+
+	// how far apart two printed numbers are, in units in the last place
+	inline double ulps_between(const std::string& expected, const std::string& actual) {
+		const double a = std::strtod(expected.c_str(), 0);
+		const double b = std::strtod(actual.c_str(), 0);
+		if(a == b) {
+			return 0.0;
+		}
+		const double magnitude = std::max(std::fabs(a), std::fabs(b));
+		const double own = magnitude > 0.0 ? std::ldexp(std::numeric_limits<double>::epsilon(), std::ilogb(magnitude)) : std::numeric_limits<double>::denorm_min();
+		const double unit = std::max(own, std::max(printed_unit(expected), printed_unit(actual)));
+		return std::fabs(a - b) / unit;
+	}
+
+	inline bool read_file(const std::string& path, std::string& contents) {
+		std::ifstream in(path.c_str(), std::ios_base::in | std::ios_base::binary);
+		if(!in) {
+			return false;
+		}
+		std::ostringstream os;
+		os << in.rdbuf();
+		contents = os.str();
+		return true;
+	}
+}
+
+// every entry of a golden file; an unreadable file is an empty one
+inline std::vector<golden_entry> read_golden(const std::string& path) {
+	std::vector<golden_entry> entries;
+	std::ifstream in(path.c_str());
+	std::string line;
+	while(std::getline(in, line)) {
+		if(line.empty() || line[0] == '#') {
+			continue;
+		}
+		std::istringstream fields(line);
+		golden_entry entry;
+		std::string mode;
+		if(!(fields >> entry.kernel >> entry.size >> entry.output >> mode >> entry.digest)) {
+			continue;
+		}
+		entry.tolerant = mode == "ulp";
+		std::string number;
+		while(fields >> number) {
+			entry.numbers.push_back(number);
+		}
+		entries.push_back(entry);
+	}
+	return entries;
+}
+
+// adds the entries to the file, replacing any for the same kernel, size and
+// output and keeping the rest in order
+inline bool write_golden(const std::string& path, const std::vector<golden_entry>& updates) {
+	std::vector<std::string> lines;
+	{
+		std::ifstream in(path.c_str());
+		std::string line;
+		while(std::getline(in, line)) {
+			std::istringstream fields(line);
+			std::string kernel, size, output;
+			bool replaced = false;
+			if(!line.empty() && line[0] != '#' && fields >> kernel >> size >> output) {
+				for(size_t i = 0; i < updates.size() && !replaced; ++i) {
+					replaced = updates[i].key() == kernel + " " + size + " " + output;
+				}
+			}
+			if(!replaced) {
+				lines.push_back(line);
+			}
+		}
+	}
+	for(size_t i = 0; i < updates.size(); ++i) {
+		std::string line = updates[i].key() + (updates[i].tolerant ? " ulp " : " exact ") + updates[i].digest;
+		for(size_t j = 0; j < updates[i].numbers.size(); ++j) {
+			line += " " + updates[i].numbers[j];
+		}
+		lines.push_back(line);
+	}
+	std::ofstream out(path.c_str(), std::ios_base::out | std::ios_base::trunc);
+	for(size_t i = 0; i < lines.size(); ++i) {
+		out << lines[i] << "\n";
+	}
+	return static_cast<bool>(out);
+}
+
+// The golden entry for an output, from its digest alone (exact) or its
+// text (tolerant).
+inline golden_entry exact_output(const std::string& output, unsigned long long digest, unsigned long long bytes) {
+	golden_entry entry;
+	entry.output = output;
+	entry.digest = verify_detail::format_digest(digest, bytes);
+	return entry;
+}
+
+inline golden_entry tolerant_output(const std::string& output, const std::string& text) {
+	golden_entry entry;
+	entry.output = output;
+	entry.tolerant = true;
+	entry.digest = verify_detail::split_numbers(text, entry.numbers);
+	return entry;
+}
+
+inline golden_entry file_output(const std::string& path, bool tolerant, bool& found) {
+	std::string contents;
+	found = verify_detail::read_file(path, contents);
+	if(tolerant) {
+		return tolerant_output(path, contents);
+	}
+	unsigned long long digest = 14695981039346656037ull;
+	for(size_t i = 0; i < contents.size(); ++i) {
+		digest = (digest ^ static_cast<unsigned char>(contents[i])) * 1099511628211ull;
+	}
+	return exact_output(path, digest, contents.size());
+}
+
+// Compares an output against its golden entry. Returns true if they agree;
+// otherwise explains why not.
+inline bool matches_golden(const golden_entry& golden, const golden_entry& actual, double max_ulps, std::string& why) {
+	if(golden.tolerant != actual.tolerant) {
+		why = "golden entry was recorded " + std::string(golden.tolerant ? "with" : "without") + " a tolerance; record it again";
+		return false;
+	}
+	if(golden.digest != actual.digest) {
+		why = "expected " + golden.digest + ", got " + actual.digest;
+		return false;
+	}
+	if(golden.numbers.size() != actual.numbers.size()) {
+		why = "different number of results";
+		return false;
+	}
+	for(size_t i = 0; i < golden.numbers.size(); ++i) {
+		const double ulps = verify_detail::ulps_between(golden.numbers[i], actual.numbers[i]);
+		if(!(ulps <= max_ulps)) {
+			std::ostringstream os;
+			os << "result " << i + 1 << " is " << actual.numbers[i] << ", expected " << golden.numbers[i]
+			   << " (" << ulps << " ulps, BENCH_ULPS " << max_ulps << ")";
+			why = os.str();
+			return false;
+		}
+	}
+	return true;
+}
+
+#endif
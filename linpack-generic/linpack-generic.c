@@ -66,6 +66,8 @@
 #include <stdlib.h>
 #include <time.h> 
 
+#include "results.h"
+
 
 /* this is truly rank, but it's minimally invasive, and lifted in part from the STREAM scores */
 
@@ -136,6 +138,8 @@ int main (int argc, char *argv[])
         char expect[5][20];
         char title[5][20];
         int errors;
+        bench_result result;
+        char size[16], check[96];
         
  
         printf("\n");
@@ -477,6 +481,31 @@ int main (int argc, char *argv[])
     }
     errors = 0;
 
+    sprintf(size, "%d", n);
+    bench_result_init(&result, "linpack", "generic", size);
+    bench_result_peak_rss(&result);
+    bench_result_metric(&result, "mflops", (double)mflops, "MFLOPS");
+    bench_result_metric(&result, "mflops_lda201", (double)atime[3][6], "MFLOPS");
+    bench_result_metric(&result, "mflops_lda200", (double)atime[3][12], "MFLOPS");
+    bench_result_metric(&result, "dgefa", (double)atime[0][0], "s");
+    bench_result_metric(&result, "dgesl", (double)atime[1][0], "s");
+    bench_result_metric(&result, "passes", (double)ntimes, "");
+    /* the two leading dimensions are different configurations: only the
+       lda=201 passes are the samples compared against a baseline */
+    for (j=1 ; j<6 ; j++)
+    {
+        bench_result_metric(&result, "sample", 1.0e6 * (double)atime[2][j], "us");
+    }
+    for (j=7 ; j<12 ; j++)
+    {
+        bench_result_metric(&result, "sample_lda200", 1.0e6 * (double)atime[2][j], "us");
+    }
+    sprintf(check, "residn %.1f resid %.8e x[0]-1 %.8e x[n-1]-1 %.8e",
+            (double)residn, (double)resid, (double)x1, (double)x2);
+    bench_result_check(&result, check);
+    bench_result_emit(&result);
+    bench_result_free(&result);
+
     printf ("\n");
 }
      
@@ -27,17 +27,15 @@
 #include <vector>
 #include <iostream>
 
-#include "timer.hpp"
+#include "runner.hpp"
+#include "buffers.h"
 
 typedef unsigned char Byte;
 
 using namespace std;
 
-int main(int argc, char* argv[])
+void mandelbrot(const unsigned N)
 {
-	high_resolution_timer timer;
-
-	const unsigned N              = max(0, (argc > 1) ? atoi(argv[1]) : 16000);
 	const unsigned width          = N;
 	const unsigned height         = N;
 	const unsigned max_x          = (width + 7) / 8;
@@ -47,9 +45,9 @@ int main(int argc, char* argv[])
 
 	FILE* out = fopen("mb.pbm", "wb");
 
-	vector<Byte> buffer(height * max_x);
+	vector<Byte, buffer_allocator<Byte> > buffer(height * max_x);
 
-	std::vector<double> cr0(8 * max_x);
+	std::vector<double, buffer_allocator<double> > cr0(8 * max_x);
 	for (unsigned x = 0; x < max_x; ++x)
 	{
 		for (unsigned k = 0; k < 8; ++k)
@@ -105,9 +103,14 @@ int main(int argc, char* argv[])
 
 	fprintf(out, "P4\n%u %u\n", width, height);
 	fwrite(&buffer[0], buffer.size(), 1, out);
+	fclose(out);
+}
 
-	high_resolution_timer::duration dur = timer.pulse();
+int main(int argc, char* argv[])
+{
+	const unsigned N = max(0, (argc > 1) ? atoi(argv[1]) : 16000);
 
-	std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(dur).count() << std::endl;
-	return 0;
+	return run_benchmark([=]() {
+		mandelbrot(N);
+	}, benchmark_options::from_environment().identify(argv[0], N).writes("mb.pbm"));
 }
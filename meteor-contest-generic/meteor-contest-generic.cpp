@@ -12,7 +12,7 @@
 #include <set>
 #include <iostream>
 
-#include "timer.hpp"
+#include "runner.hpp"
 
 using namespace std;
 
@@ -582,16 +582,13 @@ void create_utlity_maps() {
 }
 
 int main (int argc, char * const argv[]) {
-	high_resolution_timer timer;
-
 	num_to_find = (argc > 1) ? atoi(argv[1]) : 2098;
 
-	create_piece_maps();
-	create_utlity_maps();
-	find_all();
-	print_results();
-
-	high_resolution_timer::duration dur = timer.pulse();
-	std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(dur).count() << std::endl;
-	return 0;
+	// the solver accumulates its solutions in globals
+	return run_benchmark([]() {
+		create_piece_maps();
+		create_utlity_maps();
+		find_all();
+		print_results();
+	}, benchmark_options::from_environment().identify(argv[0], num_to_find).single_shot());
 }
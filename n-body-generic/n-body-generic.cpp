@@ -12,7 +12,7 @@
 #include <math.h>
 #include <iostream>
 
-#include "timer.hpp"
+#include "runner.hpp"
 
 namespace 
 {
@@ -242,24 +242,19 @@ struct
 
 int main(int argc,char** argv)
 {
-  high_resolution_timer timer;
-  auto solar_system = construct_tuple(sun,jupiter,saturn,uranus,neptune);
-  offset(solar_system);
-
-  printf ("%.9f\n", energy(solar_system));
-  
   const int n = argc > 1 ? atoi(argv[1]) : 50000000;
-  
-  for (int i = 1; i <= n; i++)
-  {
-    advance(solar_system);
-  }
 
-  printf ("%.9f\n", energy(solar_system));
+  return run_benchmark([=]() {
+    auto solar_system = construct_tuple(sun,jupiter,saturn,uranus,neptune);
+    offset(solar_system);
 
-  high_resolution_timer::duration dur = timer.pulse();
+    printf ("%.9f\n", energy(solar_system));
 
-  std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(dur).count() << std::endl;
+    for (int i = 1; i <= n; i++)
+    {
+      advance(solar_system);
+    }
 
-  return 0;
+    printf ("%.9f\n", energy(solar_system));
+  }, benchmark_options::from_environment().identify(argv[0], n).floating_point_output());
 }
@@ -15,7 +15,8 @@ converted from java to c++,added sse support, by Branimir Maksimovic
 #include <emmintrin.h>
 #include <immintrin.h>
 
-#include "timer.hpp"
+#include "runner.hpp"
+#include "cpu_features.hpp"
 
 #ifdef WIN32
 #define ALIGN_SUFFIX(X)
@@ -98,6 +99,95 @@ public: Body(){}
 		}
 };
 
+// the separations of every pair of bodies, one array per axis so that the
+// vector versions can load them as they are
+struct R{
+	ALIGN_PREFIX(64) double dx[1000] ALIGN_SUFFIX(64);
+	ALIGN_PREFIX(64) double dy[1000] ALIGN_SUFFIX(64);
+	ALIGN_PREFIX(64) double dz[1000] ALIGN_SUFFIX(64);
+};
+
+// mag[i] = dt / |r[i]|^3 for the N pairs. The vector versions work on up to
+// 3 pairs past N, which the arrays have room for.
+typedef void (*magnitudes_fn)(const R& r, double* mag, unsigned N, double dt);
+
+void magnitudes_scalar(const R& r, double* mag, unsigned N, double dt) {
+	for(unsigned i=0; i < N; ++i) {
+		double dSquared = r.dx[i] * r.dx[i] + r.dy[i] * r.dy[i] + r.dz[i] * r.dz[i];
+		mag[i] = dt / (dSquared * sqrt(dSquared));
+	}
+}
+
+// a single-precision reciprocal square root estimate, sharpened by two
+// Newton-Raphson steps
+ISA_TARGET_SSE void magnitudes_sse(const R& r, double* mag, unsigned N, double dt) {
+	for(unsigned i=0; i < N; i+=2) {
+		__m128d dx = _mm_load_pd(&r.dx[i]);
+		__m128d dy = _mm_load_pd(&r.dy[i]);
+		__m128d dz = _mm_load_pd(&r.dz[i]);
+
+		__m128d dSquared = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+
+		__m128d distance = 
+			_mm_cvtps_pd(_mm_rsqrt_ps(_mm_cvtpd_ps(dSquared)));
+		for(unsigned j=0;j<2;++j)
+		{
+			distance = _mm_sub_pd(_mm_mul_pd(distance, _mm_set1_pd(1.5)),
+				_mm_mul_pd(_mm_mul_pd((_mm_mul_pd(_mm_set1_pd(0.5), dSquared)), distance), 
+				(_mm_mul_pd(distance, distance))));
+		}
+
+		__m128d dmag = _mm_mul_pd(_mm_div_pd(_mm_set1_pd(dt), (dSquared)), distance);
+		_mm_store_pd(&mag[i],dmag);
+	}
+}
+
+// the same, four pairs at a time
+ISA_TARGET_AVX2 void magnitudes_avx2(const R& r, double* mag, unsigned N, double dt) {
+	for(unsigned i=0; i < N; i+=4) {
+		__m256d dx = _mm256_load_pd(&r.dx[i]);
+		__m256d dy = _mm256_load_pd(&r.dy[i]);
+		__m256d dz = _mm256_load_pd(&r.dz[i]);
+
+		__m256d dSquared = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+
+		__m256d distance = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(dSquared)));
+		for(unsigned j=0;j<2;++j)
+		{
+			distance = _mm256_sub_pd(_mm256_mul_pd(distance, _mm256_set1_pd(1.5)),
+				_mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(0.5), dSquared), distance),
+				_mm256_mul_pd(distance, distance)));
+		}
+
+		__m256d dmag = _mm256_mul_pd(_mm256_div_pd(_mm256_set1_pd(dt), dSquared), distance);
+		_mm256_store_pd(&mag[i],dmag);
+	}
+}
+
+// four pairs at a time too: with ten pairs a 512-bit register would be
+// mostly padding. AVX-512VL has a double-precision estimate good to 14 bits,
+// which saves the round trip through single precision.
+ISA_TARGET_AVX512 void magnitudes_avx512(const R& r, double* mag, unsigned N, double dt) {
+	for(unsigned i=0; i < N; i+=4) {
+		__m256d dx = _mm256_load_pd(&r.dx[i]);
+		__m256d dy = _mm256_load_pd(&r.dy[i]);
+		__m256d dz = _mm256_load_pd(&r.dz[i]);
+
+		__m256d dSquared = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+
+		__m256d distance = _mm256_maskz_rsqrt14_pd(0xf, dSquared);
+		for(unsigned j=0;j<2;++j)
+		{
+			distance = _mm256_sub_pd(_mm256_mul_pd(distance, _mm256_set1_pd(1.5)),
+				_mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(0.5), dSquared), distance),
+				_mm256_mul_pd(distance, distance)));
+		}
+
+		__m256d dmag = _mm256_mul_pd(_mm256_div_pd(_mm256_set1_pd(dt), dSquared), distance);
+		_mm256_store_pd(&mag[i],dmag);
+	}
+}
+
 template<typename C>
 C initialize(std::initializer_list<typename C::value_type> items)
 {
@@ -127,59 +217,32 @@ public: NBodySystem()
 			bodies[0].offsetMomentum(px,py,pz);
 				}
 
-public: void advance(double dt) {
+public: void advance(double dt, magnitudes_fn magnitudes) {
 			unsigned N = (bodies.size()-1)*bodies.size()/2;
-			struct R{
-				double dx,dy,dz,filler;
-			};
-			static R r[1000];
-			static ALIGN_PREFIX(16) double mag[1000] ALIGN_SUFFIX(16);
+			static R r;
+			static ALIGN_PREFIX(64) double mag[1000] ALIGN_SUFFIX(64);
 
 			for(unsigned i=0,k=0; i < bodies.size()-1; ++i) {
 				Body& iBody = bodies[i];
 				for(unsigned j=i+1; j < bodies.size(); ++j,++k) {
-					r[k].dx = iBody.x - bodies[j].x;
-					r[k].dy = iBody.y - bodies[j].y;
-					r[k].dz = iBody.z - bodies[j].z;
+					r.dx[k] = iBody.x - bodies[j].x;
+					r.dy[k] = iBody.y - bodies[j].y;
+					r.dz[k] = iBody.z - bodies[j].z;
 				}
 			}
 
-			for(unsigned i=0; i < N; i+=2) {
-				__m128d dx = {0}, dy = {0}, dz = {0};
-				dx = _mm_loadl_pd(dx,&r[i].dx);
-				dy = _mm_loadl_pd(dy,&r[i].dy);
-				dz = _mm_loadl_pd(dz,&r[i].dz);
-
-				dx = _mm_loadh_pd(dx,&r[i+1].dx);
-				dy = _mm_loadh_pd(dy,&r[i+1].dy);
-				dz = _mm_loadh_pd(dz,&r[i+1].dz);
-
-
-				__m128d dSquared = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
-
-				__m128d distance = 
-					_mm_cvtps_pd(_mm_rsqrt_ps(_mm_cvtpd_ps(dSquared)));
-				for(unsigned j=0;j<2;++j)
-				{
-					distance = _mm_sub_pd(_mm_mul_pd(distance, _mm_set1_pd(1.5)),
-						_mm_mul_pd(_mm_mul_pd((_mm_mul_pd(_mm_set1_pd(0.5), dSquared)), distance), 
-						(_mm_mul_pd(distance, distance))));
-				}
-
-				__m128d dmag = _mm_mul_pd(_mm_div_pd(_mm_set1_pd(dt), (dSquared)), distance);
-				_mm_store_pd(&mag[i],dmag);
-			}
+			magnitudes(r, mag, N, dt);
 
 			for(unsigned i=0,k=0; i < bodies.size()-1; ++i) {
 				Body& iBody = bodies[i];
 				for(unsigned j=i+1; j < bodies.size(); ++j,++k) {
-					iBody.vx -= r[k].dx * bodies[j].mass * mag[k];
-					iBody.vy -= r[k].dy * bodies[j].mass * mag[k];
-					iBody.vz -= r[k].dz * bodies[j].mass * mag[k];
+					iBody.vx -= r.dx[k] * bodies[j].mass * mag[k];
+					iBody.vy -= r.dy[k] * bodies[j].mass * mag[k];
+					iBody.vz -= r.dz[k] * bodies[j].mass * mag[k];
 
-					bodies[j].vx += r[k].dx * iBody.mass * mag[k];
-					bodies[j].vy += r[k].dy * iBody.mass * mag[k];
-					bodies[j].vz += r[k].dz * iBody.mass * mag[k];
+					bodies[j].vx += r.dx[k] * iBody.mass * mag[k];
+					bodies[j].vy += r.dy[k] * iBody.mass * mag[k];
+					bodies[j].vz += r.dz[k] * iBody.mass * mag[k];
 				}
 			}
 
@@ -216,16 +279,14 @@ public: double energy(){
 };
 
 int main(int argc, char** argv) {
-	high_resolution_timer timer;
 	const int n = argc > 1 ? atoi(argv[1]) : 50000000;
 
-
-	NBodySystem bodies;
-	printf("%.9f\n", bodies.energy());
-	for (int i=0; i<n; ++i)
-		bodies.advance(0.01);
-	printf("%.9f\n", bodies.energy());
-	high_resolution_timer::duration dur = timer.pulse();
-
-	std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(dur).count() << std::endl;
+	const magnitudes_fn magnitudes = select_isa<magnitudes_fn>("magnitudes", magnitudes_scalar, magnitudes_sse, magnitudes_avx2, magnitudes_avx512);
+	return run_benchmark([=]() {
+		NBodySystem bodies;
+		printf("%.9f\n", bodies.energy());
+		for (int i=0; i<n; ++i)
+			bodies.advance(0.01, magnitudes);
+		printf("%.9f\n", bodies.energy());
+	}, benchmark_options::from_environment().identify(argv[0], n).floating_point_output());
 }
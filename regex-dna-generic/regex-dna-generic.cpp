@@ -17,7 +17,7 @@ without openmp, without assert
 //#include <regex>
 #include <boost/xpressive/xpressive.hpp>
 
-#include "timer.hpp"
+#include "runner.hpp"
 
 namespace x = boost::xpressive;
 
@@ -84,13 +84,11 @@ void regex_dna(const char* filename) {
 
 int main(int argc, char* argv[])
 {
-	high_resolution_timer timer;
-
 	if(argc < 2) {
 		return -1;
 	}
-	regex_dna(argv[1]);
-	high_resolution_timer::duration dur = timer.pulse();
-	std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(dur).count() << std::endl;
-	return 0;
+	const char* filename = argv[1];
+	return run_benchmark([=]() {
+		regex_dna(filename);
+	}, benchmark_options::from_environment().identify(argv[0], filename));
 }
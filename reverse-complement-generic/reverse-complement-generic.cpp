@@ -13,7 +13,7 @@
 #include <iterator>
 #include <iostream>
 
-#include "timer.hpp"
+#include "runner.hpp"
 
 using namespace std;
 
@@ -47,11 +47,8 @@ void print_revcomp(Header const& header, Segment const& seg, ostream& out = std:
         out << comp.substr(i++*LINELENGTH,LINELENGTH) << "\n";
 }
 
-int main ()
+void reverse_complement()
 {
-  high_resolution_timer timer;
-  ios_base::sync_with_stdio(false);
-
   Segment line, segment; 
   Header header;
 
@@ -68,7 +65,12 @@ int main ()
           segment += line;
   }
   print_revcomp(header, segment);
-  high_resolution_timer::duration dur = timer.pulse();
-  std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(dur).count() << std::endl;
-  return 0;
+}
+
+int main (int, char* argv[])
+{
+  ios_base::sync_with_stdio(false);
+
+  // stdin can only be read once
+  return run_benchmark(reverse_complement, benchmark_options::from_environment().identify(argv[0], "stdin").single_shot());
 }
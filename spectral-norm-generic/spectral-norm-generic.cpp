@@ -13,13 +13,16 @@
 #include <iostream>
 #include <iomanip>
 
-#include "timer.hpp"
+#include "runner.hpp"
+#include "buffers.h"
 
 using namespace std;
 
+typedef vector<double, buffer_allocator<double> > doubles;
+
 double eval_A(int i, int j) { return 1.0 / ((i+j)*(i+j+1)/2 + i + 1); }
 
-void eval_A_times_u(const vector<double> &u, vector<double> &Au)
+void eval_A_times_u(const doubles &u, doubles &Au)
 {
 	const int size = u.size();
 	for(int i = 0; i < size; i++) {
@@ -31,7 +34,7 @@ void eval_A_times_u(const vector<double> &u, vector<double> &Au)
 	}
 }
 
-void eval_At_times_u(const vector<double> &u, vector<double> &Au)
+void eval_At_times_u(const doubles &u, doubles &Au)
 {
 	const int size = u.size();
 	for(int i = 0; i < size; i++) {
@@ -43,18 +46,15 @@ void eval_At_times_u(const vector<double> &u, vector<double> &Au)
 	}
 }
 
-void eval_AtA_times_u(const vector<double> &u, vector<double> &AtAu, vector<double>& vv)
+void eval_AtA_times_u(const doubles &u, doubles &AtAu, doubles& vv)
 {
 	eval_A_times_u(u, vv);
 	eval_At_times_u(vv, AtAu);
 }
 
-int main(int argc, char *argv[])
+void spectral_norm(int N)
 {
-	high_resolution_timer timer;
-
-	int N = ((argc == 2) ? atoi(argv[1]) : 2000);
-	vector<double> u(N), v(N), w(N);
+	doubles u(N), v(N), w(N);
 
 	fill(u.begin(), u.end(), 1.0);
 
@@ -70,8 +70,14 @@ int main(int argc, char *argv[])
 	}
 
 	cout << setprecision(10) << sqrt(vBv/vv) << endl;
-	high_resolution_timer::duration dur = timer.pulse();
-	std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(dur).count() << std::endl;
-	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int N = ((argc == 2) ? atoi(argv[1]) : 2000);
+
+	return run_benchmark([=]() {
+		spectral_norm(N);
+	}, benchmark_options::from_environment().identify(argv[0], N).floating_point_output());
 }
 
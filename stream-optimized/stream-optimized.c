@@ -53,6 +53,9 @@
 #include <Windows.h>
 #endif
 
+#include "results.h"
+#include "buffers.h"
+
 /*-----------------------------------------------------------------------
  * INSTRUCTIONS:
  *
@@ -197,6 +200,8 @@ static double	avgtime[4] = {0}, maxtime[4] = {0},
 static char	*label[4] = {"Copy:      ", "Scale:     ",
     "Add:       ", "Triad:     "};
 
+static char	*metric[4] = {"copy", "scale", "add", "triad"};
+
 static double	bytes[4] = {
     2 * sizeof(STREAM_TYPE) * STREAM_ARRAY_SIZE,
     2 * sizeof(STREAM_TYPE) * STREAM_ARRAY_SIZE,
@@ -204,8 +209,13 @@ static double	bytes[4] = {
     3 * sizeof(STREAM_TYPE) * STREAM_ARRAY_SIZE
     };
 
+/* share of the arrays on each NUMA node, and of that the share used by
+ * threads running on the node */
+static double	numa_share[BENCH_NUMA_MAX_NODES], numa_local[BENCH_NUMA_MAX_NODES];
+
 extern double mysecond();
-extern void checkSTREAMresults();
+extern int checkSTREAMresults();
+extern int checkNUMAplacement();
 #ifdef TUNED
 extern void tuned_STREAM_Copy();
 extern void tuned_STREAM_Scale(STREAM_TYPE scalar);
@@ -224,10 +234,13 @@ main()
     intptr_t	j;
     STREAM_TYPE		scalar;
     double		t, times[4][NTIMES];
+    int			errors, threads = 1;
+    bench_result	result;
+    char		size[32];
 
-    a = calloc(STREAM_ARRAY_SIZE + OFFSET, sizeof(STREAM_TYPE));
-    b = calloc(STREAM_ARRAY_SIZE + OFFSET, sizeof(STREAM_TYPE));
-    c = calloc(STREAM_ARRAY_SIZE + OFFSET, sizeof(STREAM_TYPE));
+    a = bench_buffer_alloc((STREAM_ARRAY_SIZE + OFFSET) * sizeof(STREAM_TYPE));
+    b = bench_buffer_alloc((STREAM_ARRAY_SIZE + OFFSET) * sizeof(STREAM_TYPE));
+    c = bench_buffer_alloc((STREAM_ARRAY_SIZE + OFFSET) * sizeof(STREAM_TYPE));
     if(!a || !b || !c)
     {
         printf("Memory allocation failed.\n");
@@ -281,6 +294,7 @@ main()
 #pragma omp atomic 
 		k++;
     printf ("Number of Threads counted = %i\n",k);
+    threads = k;
 #endif
 
     /* Get initial value for system clock. */
@@ -392,12 +406,54 @@ main()
     printf(HLINE);
 
     /* --- Check Results --- */
-    checkSTREAMresults();
+    errors = checkSTREAMresults();
     printf(HLINE);
 
-    free(a);
-    free(b);
-    free(c);
+    /* --- NUMA placement --- */
+    if (bench_numa_policy() != BENCH_NUMA_DEFAULT || bench_numa_node_count() > 1) {
+	checkNUMAplacement();
+	printf(HLINE);
+    }
+
+    /* freed first, so that the pages they actually got are known */
+    bench_buffer_free(a);
+    bench_buffer_free(b);
+    bench_buffer_free(c);
+    bench_buffer_report(stdout, "Arrays: ");
+    printf(HLINE);
+
+    sprintf(size, "%llu", (unsigned long long) STREAM_ARRAY_SIZE);
+    bench_result_init(&result, "stream", "optimized", size);
+    result.threads = threads;
+    bench_result_peak_rss(&result);
+    bench_result_buffers(&result);
+    for (j=0; j<4; j++) {
+	char	name[32];
+	sprintf(name, "%s_rate", metric[j]);
+	bench_result_metric(&result, name, 1.0E-06 * bytes[j]/mintime[j], "MB/s");
+	sprintf(name, "%s_avg", metric[j]);
+	bench_result_metric(&result, name, avgtime[j], "s");
+	sprintf(name, "%s_min", metric[j]);
+	bench_result_metric(&result, name, mintime[j], "s");
+	sprintf(name, "%s_max", metric[j]);
+	bench_result_metric(&result, name, maxtime[j], "s");
+    }
+    for (k=0; k<BENCH_NUMA_MAX_NODES; k++) {
+	char	name[32];
+	if (numa_share[k] == 0.0)
+	    continue;
+	sprintf(name, "node%d_share", k);
+	bench_result_metric(&result, name, numa_share[k], "");
+	sprintf(name, "node%d_local", k);
+	bench_result_metric(&result, name, numa_local[k], "");
+    }
+    /* one sample per iteration: the time for all four kernels */
+    for (k=1; k<NTIMES; k++)
+	bench_result_metric(&result, "sample", 1.0E6 * (times[0][k] + times[1][k] + times[2][k] + times[3][k]), "us");
+    bench_result_check(&result, errors == 0 ? "Solution Validates" : "Failed Validation");
+    bench_result_emit(&result);
+    bench_result_free(&result);
+
     return 0;
 }
 
@@ -471,7 +527,42 @@ double mysecond()
 #ifndef abs
 #define abs(a) ((a) >= 0 ? (a) : -(a))
 #endif
-void checkSTREAMresults ()
+/* Where the pages of a, b and c are, and how many of each node's pages are
+ * used by threads running on that node (see bench_numa_placement). Threads
+ * move between nodes unless they are pinned (BENCH_CPUS, OMP_PROC_BIND).
+ *
+ * Only the placement is reported: the rates above are for the arrays as a
+ * whole. Local and remote bandwidth are compared by bench-sweep -m all,
+ * which keeps the threads on one node and reruns with BENCH_NUMA=bind and
+ * BENCH_NUMA_NODE set to each node in turn, reporting the rates per node. */
+int
+checkNUMAplacement()
+    {
+    long long	pages[BENCH_NUMA_MAX_NODES], local[BENCH_NUMA_MAX_NODES], total;
+    void	*arrays[3];
+    int		k;
+
+    arrays[0] = a; arrays[1] = b; arrays[2] = c;
+    total = bench_numa_placement(arrays, 3, STREAM_ARRAY_SIZE, sizeof(STREAM_TYPE), pages, local);
+    printf("NUMA policy %s, %d node(s) with memory\n",
+	bench_numa_policy_name(bench_numa_policy()), bench_numa_node_count());
+    if (total == 0) {
+	printf("The nodes of the arrays' pages could not be read\n");
+	return 0;
+    }
+    printf("Node    Arrays   Local\n");
+    for (k=0; k<BENCH_NUMA_MAX_NODES; k++) {
+	if (pages[k] == 0)
+	    continue;
+	numa_share[k] = (double) pages[k] / total;
+	numa_local[k] = (double) local[k] / pages[k];
+	printf("%4d  %7.1f%%  %5.1f%%\n", k,
+	    100.0 * numa_share[k], 100.0 * numa_local[k]);
+    }
+    return 1;
+    }
+
+int checkSTREAMresults ()
 {
 	STREAM_TYPE aj,bj,cj,scalar;
 	STREAM_TYPE aSumErr,bSumErr,cSumErr;
@@ -587,6 +678,7 @@ void checkSTREAMresults ()
 	printf ("    Observed a(1), b(1), c(1): %f %f %f \n",a[1],b[1],c[1]);
 	printf ("    Rel Errors on a, b, c:     %e %e %e \n",abs(aAvgErr/aj),abs(bAvgErr/bj),abs(cAvgErr/cj));
 #endif
+	return err;
 }
 
 #ifdef TUNED
@@ -8,7 +8,26 @@
 
 #include "timer.hpp"
 
+volatile long long clock_sink;
+
+// what one reading of a clock costs, in nanoseconds
+template<typename clock_t>
+double reading_cost() {
+	const int readings = 1000000;
+	high_resolution_timer timer;
+	typename clock_t::time_point last;
+	for(int i = 0; i < readings; ++i) {
+		last = clock_t::now();
+	}
+	clock_sink = last.time_since_epoch().count();
+	return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(timer.pulse()).count()) / readings;
+}
+
 int main() {
+#ifdef TIMER_TSC
+	// first, so that its calibration is not part of the other's second
+	tsc_timer tsc;
+#endif
 	high_resolution_timer timer;
 #ifdef WIN32
 	Sleep(1000);
@@ -17,5 +36,15 @@ int main() {
 #endif
 	high_resolution_timer::duration dur = timer.pulse();
 	std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(dur).count() << std::endl;
+#ifdef TIMER_TSC
+	// the same second by the time-stamp counter; the two should agree to a
+	// few microseconds
+	tsc_timer::duration tsc_dur = tsc.pulse();
+	std::cerr << "tsc: " << std::chrono::duration_cast<std::chrono::microseconds>(tsc_dur).count() << " us"
+	          << (tsc_clock::usable() ? "" : " (no invariant TSC; steady_clock fallback)") << "\n"
+	          << "tsc: " << tsc_clock::ticks_per_second() / 1.0e6 << " MHz, invariant " << (tsc_clock::invariant() ? "yes" : "no") << "\n"
+	          << "reading: " << reading_cost<high_resolution_timer::clock_type>() << " ns high resolution, "
+	          << reading_cost<tsc_clock>() << " ns tsc" << std::endl;
+#endif
 	return 0;
 }
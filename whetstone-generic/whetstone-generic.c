@@ -173,6 +173,8 @@
 #include <stdlib.h>     /* for exit   - 1 occurrence   */
 #include <time.h> 
 
+#include "results.h"
+
 /*  #include "cpuidh.h" */
 
 /*PRECISION PRECISION PRECISION PRECISION PRECISION PRECISION PRECISION*/
@@ -256,6 +258,8 @@ int main(int argc, char *argv[])
 	char compiler[80], options[256], general[10][80] = {" "};
 	char endit[80];
 	int i;
+	bench_result result;
+	char name[32];
 
 	printf("\n");
 	printf("##########################################\n");
@@ -328,6 +332,35 @@ int main(int argc, char *argv[])
 
 	if (Check == 0) printf("Wrong answer  ");
 
+	/* the pass count is calibrated, so it is a result, not a problem size */
+	bench_result_init(&result, "whetstone", "generic", "calibrated");
+	bench_result_peak_rss(&result);
+	bench_result_metric(&result, "passes", (double) xtra * x100, "");
+	bench_result_metric(&result, "mwips", mwips, "MWIPS");
+	bench_result_metric(&result, "time", TimeUsed, "s");
+	/* a single timed run, per pass since the pass count varies; repeat the
+	 * program for more samples */
+	bench_result_metric(&result, "sample", 1.0e6 * TimeUsed / ((double) xtra * x100), "us");
+	for (section = 1; section <= 8; section++)
+	{
+		sprintf(name, "n%d_time", section);
+		bench_result_metric(&result, name, loop_time[section], "s");
+		/* floating point sections flag their MOPS with 99999 */
+		if (loop_mops[section] == 99999)
+		{
+			sprintf(name, "n%d_mflops", section);
+			bench_result_metric(&result, name, loop_mflops[section], "MFLOPS");
+		}
+		else
+		{
+			sprintf(name, "n%d_mops", section);
+			bench_result_metric(&result, name, loop_mops[section], "MOPS");
+		}
+	}
+	bench_result_check(&result, Check == 0 ? "Wrong answer" : "OK");
+	bench_result_emit(&result);
+	bench_result_free(&result);
+
 	printf ("\n");
 	printf ("A new results file, whets.txt,  will have been created in the same\n");
 	printf ("directory as the .EXE files, if one did not already exist.\n\n");